@@ -5,6 +5,76 @@
 #include <memory>
 #include <cstdarg>
 #include <cassert>
+#include <cstring>
+#include <string_view>
+#include <new>
+#include <charconv>
+#include <thread>
+#include <mutex>
+#include <cstdint>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <atomic>
+#include <unordered_set>
+#include <chrono>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#include <emmintrin.h>
+	#define BLOG_HAS_SSE2 1
+#else
+	#define BLOG_HAS_SSE2 0
+#endif
+
+#if defined(_MSC_VER)
+	#include <intrin.h>
+#endif
+
+// Used for loading the modules compiled ahead of time (see AotModule).
+// The parts of <windows.h> that we need are declared here, as it would collide with our names.
+#if defined(_WIN32)
+	extern "C" __declspec(dllimport) void* __stdcall LoadLibraryA(const char* fileName);
+	extern "C" __declspec(dllimport) void* __stdcall GetProcAddress(void* module, const char* procName);
+	#define BLOG_AOT_EXPORT extern "C" __declspec(dllexport)
+#else
+	#include <dlfcn.h>
+	#define BLOG_AOT_EXPORT extern "C" __attribute__((visibility("default")))
+#endif
+
+// Used for mapping files in memory (see MappedFile), on Windows the files are read instead.
+// The daemon mode listens on Unix domain sockets, where those are available (see Daemon).
+#if !defined(_WIN32)
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+	#include <csignal>
+	#include <cerrno>
+	#include <sys/socket.h>
+	#include <sys/un.h>
+#endif
+
+// Returns the index of the lowest set bit. @x must not be 0.
+inline int countTrailingZeros(const uint32_t x)
+{
+#if defined(_MSC_VER)
+	unsigned long idx;
+	_BitScanForward(&idx, x);
+	return (int)idx;
+#else
+	return __builtin_ctz(x);
+#endif
+}
+
+// A 64-bit FNV-1a hash. Unlike std::hash, the value is the same across builds, so it could be stored.
+inline uint64_t fnv1aHash(const void* const data, const size_t size)
+{
+	uint64_t hash = 0xcbf29ce484222325ull;
+	for(size_t t = 0; t < size; ++t) {
+		hash = (hash ^ ((const uint8_t*)data)[t]) * 0x100000001b3ull;
+	}
+	return hash;
+}
 
 // A location in our source code used primerly for error reporting.
 struct Location
@@ -99,7 +169,9 @@ struct Token
 	{}
 
 	TokenType type = tokenType_endToken;
-	float numberData; // The number asociated with this token (if any).
+	float numberData = 0.f; // The number asociated with this token (if any).
+	bool isIntegerNumber = false; // True if the number has no fractional part in the source and fits in integerData.
+	int64_t integerData = 0;
 	std::string strData; // The string asociated with this token (if any). Example usage is with identifiers or string literals.
 	Location location; // The location of the token in the source file.
 };
@@ -228,16 +300,21 @@ private :
 		else if(*m_ptr == ',') { eatChar(); return Token(tokenType_comma, m_column, m_line); }
 		else if(isdigit(*m_ptr))
 		{
-			// This should be a number.
+			// This should be a number. Numbers without a fractional part are integers, unless they are too large for one.
 			float numberAccum = 0;
+			int64_t integerAccum = 0;
+			bool isInteger = true;
 			while(isdigit(*m_ptr)){
 				const int digit = *m_ptr - '0';
 				numberAccum = numberAccum*10.f + float(digit);
+				isInteger = isInteger && integerAccum <= (INT64_MAX - digit) / 10;
+				integerAccum = isInteger ? integerAccum*10 + digit : 0;
 				eatChar();
 			}
 
 			if(*m_ptr == '.')
 			{
+				isInteger = false;
 				float mult = 0.1f;
 				eatChar();
 				while(isdigit(*m_ptr)){
@@ -251,6 +328,8 @@ private :
 			Token token;
 			token.type = tokenType_number;
 			token.numberData = numberAccum;
+			token.isIntegerNumber = isInteger;
+			token.integerData = integerAccum;
 			token.location.column = m_column;
 			token.location.line = m_line;
 
@@ -269,6 +348,362 @@ private :
 	const char* m_ptr = nullptr;
 };
 
+// The buffer behind every string value in our language.
+// Strings are immutable once created, so a single buffer is shared between all the values that hold it.
+// The reference count is intentionally not atomic, as an Executor runs on a single thread.
+//
+// A buffer could also be a rope - a lazy concatenation of two other buffers. Ropes make repeated
+// concatenation like s = s + piece; linear, the characters are gathered (flattened) only when someone needs them.
+struct StringBuffer
+{
+	int refCount = 1;
+	bool isImmortal = false; // Immortal buffers ignore reference counting, they are owned by a string pool (see Parser::internStringConstant).
+	mutable bool isHashComputed = false;
+	mutable bool hasSeparateChars = false; // True if the characters were allocated separately (after flattening a rope).
+	mutable size_t hash = 0; // Cached on first use, as the contents never change.
+	size_t length = 0;
+	mutable char* chars = nullptr; // The characters of the string (zero terminated unless this is a slice). nullptr if this is a rope that isn't flattened yet.
+	mutable StringBuffer* ropeLeft = nullptr; // If this is a rope, the two buffers that we are concatenating (we own a reference to each).
+	mutable StringBuffer* ropeRight = nullptr;
+	mutable StringBuffer* sliceParent = nullptr; // If this is a slice, the buffer that owns the characters (we own a reference to it).
+
+	// Concatenations resulting in strings shorter than this are just copied, ropes aren't worth it for them.
+	static const size_t kMinRopeLength = 256;
+
+	// Substrings shorter than this are copied, as a slice needs an allocation anyway and keeps the whole parent alive.
+	static const size_t kMinSliceLength = 32;
+
+	// Allocates a buffer with space for @length characters and the zero terminator in a single allocation.
+	static StringBuffer* allocate(const size_t length) {
+		void* const memory = ::operator new(sizeof(StringBuffer) + length + 1);
+		StringBuffer* const buffer = new(memory) StringBuffer();
+		buffer->length = length;
+		buffer->chars = (char*)(buffer + 1);
+		buffer->chars[length] = '\0';
+		return buffer;
+	}
+
+	// Allocates a rope node, the references to @left and @right are retained.
+	static StringBuffer* allocateRope(StringBuffer* const left, StringBuffer* const right) {
+		StringBuffer* const buffer = new StringBuffer();
+		buffer->length = left->length + right->length;
+		buffer->ropeLeft = left;
+		buffer->ropeRight = right;
+		retain(left);
+		retain(right);
+		return buffer;
+	}
+
+	// Allocates a buffer that references @length characters of @parent starting at @offset, without copying them.
+	static StringBuffer* allocateSlice(StringBuffer* parent, size_t offset, const size_t length) {
+		parent->flatten();
+		if(parent->sliceParent) {
+			offset += parent->chars - parent->sliceParent->chars;
+			parent = parent->sliceParent;
+		}
+
+		StringBuffer* const buffer = new StringBuffer();
+		buffer->length = length;
+		buffer->chars = parent->chars + offset;
+		buffer->sliceParent = parent;
+		retain(parent);
+		return buffer;
+	}
+
+	static void retain(StringBuffer* const buffer) {
+		if(buffer && !buffer->isImmortal) {
+			buffer->refCount++;
+		}
+	}
+
+	// Drops one reference, destroying the buffer if this was the last one.
+	// Ropes could be very deep (one node per concatenation), so we don't recurse here.
+	static void release(StringBuffer* const buffer) {
+		std::vector<StringBuffer*> pending;
+		StringBuffer* next = buffer;
+		while(next != nullptr) {
+			if(!next->isImmortal && --next->refCount == 0) {
+				if(next->ropeLeft) pending.push_back(next->ropeLeft);
+				if(next->ropeRight) pending.push_back(next->ropeRight);
+				if(next->sliceParent) pending.push_back(next->sliceParent);
+				destroy(next);
+			}
+
+			next = nullptr;
+			if(!pending.empty()) {
+				next = pending.back();
+				pending.pop_back();
+			}
+		}
+	}
+
+	// Gathers the characters of a rope into a single array. Once flattened the children are not needed anymore.
+	void flatten() const {
+		if(chars != nullptr) {
+			return;
+		}
+
+		char* const result = (char*)::operator new(length + 1);
+		char* writePtr = result;
+
+		std::vector<const StringBuffer*> stack;
+		stack.push_back(this);
+		while(!stack.empty()) {
+			const StringBuffer* const piece = stack.back();
+			stack.pop_back();
+
+			if(piece->chars) {
+				memcpy(writePtr, piece->chars, piece->length);
+				writePtr += piece->length;
+			} else {
+				stack.push_back(piece->ropeRight);
+				stack.push_back(piece->ropeLeft);
+			}
+		}
+
+		result[length] = '\0';
+		chars = result;
+		hasSeparateChars = true;
+
+		StringBuffer* const left = ropeLeft;
+		StringBuffer* const right = ropeRight;
+		ropeLeft = nullptr;
+		ropeRight = nullptr;
+		release(left);
+		release(right);
+	}
+
+	// Gives a slice its own zero terminated copy of the characters, after that the parent is not needed anymore.
+	void detachFromParent() const {
+		if(sliceParent == nullptr) {
+			return;
+		}
+
+		char* const result = (char*)::operator new(length + 1);
+		memcpy(result, chars, length);
+		result[length] = '\0';
+		chars = result;
+		hasSeparateChars = true;
+
+		StringBuffer* const parent = sliceParent;
+		sliceParent = nullptr;
+		release(parent);
+	}
+
+	static void destroy(StringBuffer* const buffer) {
+		if(buffer->hasSeparateChars) {
+			::operator delete(buffer->chars);
+		}
+
+		buffer->~StringBuffer();
+		::operator delete(buffer);
+	}
+};
+
+// A handle to a StringBuffer. Copying the handle is O(1), it just bumps the reference count.
+// A handle that points to nothing represents an empty string.
+struct StringRef
+{
+	StringRef() = default;
+
+	// Takes ownership of one reference of the specified buffer.
+	explicit StringRef(StringBuffer* const buffer)
+		: m_buffer(buffer)
+	{}
+
+	StringRef(const StringRef& other)
+		: m_buffer(other.m_buffer)
+	{
+		retain();
+	}
+
+	StringRef(StringRef&& other) noexcept
+		: m_buffer(other.m_buffer)
+	{
+		other.m_buffer = nullptr;
+	}
+
+	~StringRef() {
+		release();
+	}
+
+	StringRef& operator=(const StringRef& other) {
+		if(m_buffer != other.m_buffer) {
+			other.retain();
+			release();
+			m_buffer = other.m_buffer;
+		}
+		return *this;
+	}
+
+	StringRef& operator=(StringRef&& other) noexcept {
+		if(this != &other) {
+			release();
+			m_buffer = other.m_buffer;
+			other.m_buffer = nullptr;
+		}
+		return *this;
+	}
+
+	static StringRef fromChars(const char* const chars, const size_t length) {
+		StringBuffer* const buffer = StringBuffer::allocate(length);
+		memcpy(buffer->chars, chars, length);
+		return StringRef(buffer);
+	}
+
+	// Creates a new string by joining the two specified char sequences with a single allocation.
+	static StringRef concat(const char* const a, const size_t aLength, const char* const b, const size_t bLength) {
+		StringBuffer* const buffer = StringBuffer::allocate(aLength + bLength);
+		memcpy(buffer->chars, a, aLength);
+		memcpy(buffer->chars + aLength, b, bLength);
+		return StringRef(buffer);
+	}
+
+	// Creates a new string by joining the two strings. Long results are ropes, so this is O(1) for them.
+	static StringRef concat(const StringRef& a, const StringRef& b) {
+		if(b.size() == 0) return a;
+		if(a.size() == 0) return b;
+
+		if(a.size() + b.size() < StringBuffer::kMinRopeLength) {
+			return concat(a.data(), a.size(), b.data(), b.size());
+		}
+
+		return StringRef(StringBuffer::allocateRope(a.m_buffer, b.m_buffer));
+	}
+
+	// Returns a view of @length characters starting at @from. Long results reference the characters of this string instead of copying them.
+	StringRef substring(const size_t from, const size_t length) const {
+		assert(from + length <= size());
+		if(from == 0 && length == size()) {
+			return *this;
+		}
+
+		if(length < StringBuffer::kMinSliceLength) {
+			return fromChars(data() + from, length);
+		}
+
+		return StringRef(StringBuffer::allocateSlice(m_buffer, from, length));
+	}
+
+	// The characters of the string, not necessarily zero terminated (see c_str).
+	const char* data() const {
+		if(m_buffer == nullptr) {
+			return "";
+		}
+
+		m_buffer->flatten();
+		return m_buffer->chars;
+	}
+
+	std::string_view view() const {
+		return std::string_view(data(), size());
+	}
+
+	const char* c_str() const {
+		if(m_buffer) {
+			m_buffer->detachFromParent();
+		}
+
+		if(m_buffer == nullptr) {
+			return "";
+		}
+		m_buffer->flatten();
+		return m_buffer->chars;
+	}
+
+	size_t size() const { return m_buffer ? m_buffer->length : 0; }
+	StringBuffer* buffer() const { return m_buffer; }
+
+	size_t hash() const {
+		if(m_buffer == nullptr) {
+			return std::hash<std::string_view>()(std::string_view());
+		}
+
+		if(m_buffer->isHashComputed == false) {
+			m_buffer->hash = std::hash<std::string_view>()(view());
+			m_buffer->isHashComputed = true;
+		}
+		return m_buffer->hash;
+	}
+
+	bool operator==(const StringRef& other) const {
+		if(m_buffer == other.m_buffer) {
+			return true;
+		}
+
+		if(size() != other.size()) {
+			return false;
+		}
+
+		// If both hashes are already known, use them to skip comparing the characters.
+		if(m_buffer && other.m_buffer && m_buffer->isHashComputed && other.m_buffer->isHashComputed && m_buffer->hash != other.m_buffer->hash) {
+			return false;
+		}
+
+		return memcmp(data(), other.data(), size()) == 0;
+	}
+
+	bool operator!=(const StringRef& other) const {
+		return !(*this == other);
+	}
+
+private :
+
+	void retain() const {
+		StringBuffer::retain(m_buffer);
+	}
+
+	void release() {
+		if(m_buffer) {
+			StringBuffer::release(m_buffer);
+		}
+		m_buffer = nullptr;
+	}
+
+	StringBuffer* m_buffer = nullptr;
+};
+
+// Returns the position of the first occurrence of @needle in @haystack at or after @from, or std::string_view::npos.
+// The candidates are found with memchr (vectorized by the C library), memmem is used where available.
+inline size_t findInString(const std::string_view haystack, const std::string_view needle, const size_t from)
+{
+	if(from > haystack.size() || needle.size() > haystack.size() - from) {
+		return std::string_view::npos;
+	}
+
+	if(needle.empty()) {
+		return from;
+	}
+
+	const char* const begin = haystack.data() + from;
+	const size_t length = haystack.size() - from;
+
+	if(needle.size() == 1) {
+		const char* const found = (const char*)memchr(begin, needle[0], length);
+		return found ? found - haystack.data() : std::string_view::npos;
+	}
+
+#if defined(__GLIBC__) || defined(__APPLE__)
+	const char* const found = (const char*)memmem(begin, length, needle.data(), needle.size());
+	return found ? found - haystack.data() : std::string_view::npos;
+#else
+	const char* candidate = begin;
+	const char* const last = begin + length - needle.size();
+	while(candidate <= last) {
+		candidate = (const char*)memchr(candidate, needle[0], last - candidate + 1);
+		if(candidate == nullptr) {
+			break;
+		}
+
+		if(memcmp(candidate + 1, needle.data() + 1, needle.size() - 1) == 0) {
+			return candidate - haystack.data();
+		}
+		candidate++;
+	}
+	return std::string_view::npos;
+#endif
+}
+
 // An id for each node type of the Abstract Syntax Tree.
 // Each node represens one "constriction" in the language.
 enum AstNodeType {
@@ -292,6 +727,7 @@ enum AstNodeType {
 	astNodeType_print,
 	astNodeType_return,
 	astNodeType_fndecl,
+	astNodeType_inlinedArgument,
 
 };
 
@@ -299,12 +735,53 @@ enum AstNodeType {
 // Each node represents a basic operation like:
 // addition, substraction, multiplication, assign and many more- All these combined in some way form an expression.
 // statements - expression, if, while, return, block of statements and so on.
+struct AstNode;
+
+// Owns the nodes created by a thread while it is the current owner of that thread (see AstNodeOwner::Scope),
+// so a program could be freed as a whole, together with the nodes that the Inliner adds while the program runs.
+// Nodes created without an owner are never freed, which is fine for a process that runs a single script.
+struct AstNodeOwner
+{
+	AstNodeOwner() = default;
+	AstNodeOwner(const AstNodeOwner&) = delete;
+	AstNodeOwner& operator=(const AstNodeOwner&) = delete;
+
+	~AstNodeOwner();
+
+	static AstNodeOwner*& current() {
+		thread_local AstNodeOwner* owner = nullptr;
+		return owner;
+	}
+
+	// Makes @owner the current owner of the calling thread while the scope is alive.
+	struct Scope
+	{
+		Scope(AstNodeOwner* const owner)
+			: m_previous(current())
+		{
+			current() = owner;
+		}
+
+		~Scope() {
+			current() = m_previous;
+		}
+
+		AstNodeOwner* const m_previous;
+	};
+
+	std::vector<AstNode*> m_nodes;
+};
+
 struct AstNode
 {
 	AstNode(AstNodeType const type, Location const location)
 		: type(type)
 		, location(location)
-	{}
+	{
+		if(AstNodeOwner* const owner = AstNodeOwner::current()) {
+			owner->m_nodes.push_back(this);
+		}
+	}
 	
 	virtual ~AstNode() = default;
 
@@ -312,6 +789,12 @@ struct AstNode
 	AstNodeType type;
 };
 
+inline AstNodeOwner::~AstNodeOwner() {
+	for(AstNode* const node : m_nodes) {
+		delete node;
+	}
+}
+
 // AstNode representing a single number literal (basically AstNode representation of the matched token by the lexer).
 struct AstNumber : public AstNode
 {
@@ -320,18 +803,54 @@ struct AstNumber : public AstNode
 		, value(value)
 	{}
 
+	AstNumber(int64_t const integerValue, Location location) 
+		: AstNode(astNodeType_number, location)
+		, value((float)integerValue)
+		, isInteger(true)
+		, integerValue(integerValue)
+	{}
+
 	float value;
+	bool isInteger = false; // If true the literal is an integer, and integerValue is used instead of value.
+	int64_t integerValue = 0;
 };
 
 // AstNode representing a single string literal (basically AstNode representation of the matched token by the lexer).
+// The value lives in the constant pool of the Parser, so evaluating the literal never copies the characters.
 struct AstString : public AstNode
 {
-	AstString(std::string s, Location location) 
+	AstString(StringRef s, Location location) 
 		: AstNode(astNodeType_string, location)
 		, value(std::move(s))
 	{}
 
-	std::string value;
+	StringRef value;
+};
+
+// Gives each distinct identifier name a small dense index. The indices are shared by every parser and executor in the process,
+// so the executor could keep its global variables in an array indexed by them (see Executor::m_globalSlots).
+// The table never shrinks, as any program that is still alive could use the indices. So that a long running process
+// (like the daemon, which compiles whatever it is sent) doesn't grow without bound, only the first kMaxSymbols names get an index,
+// the next ones get kNoSymbol and their variables are always looked up by name.
+struct Symbols
+{
+	static constexpr int kMaxSymbols = 1 << 16;
+	static constexpr int kNoSymbol = -1;
+
+	static int intern(const std::string& name) {
+		static std::mutex mutex;
+		static std::unordered_map<std::string, int> indices;
+
+		std::lock_guard<std::mutex> lock(mutex);
+		const auto itr = indices.find(name);
+		if(itr != indices.end()) {
+			return itr->second;
+		}
+		if(indices.size() >= kMaxSymbols) {
+			return kNoSymbol;
+		}
+		return indices.emplace(name, (int)indices.size()).first->second;
+	}
 };
 
 // AstNode representing a single identifer (basically AstNode representation of the matched token by the lexer).
@@ -340,23 +859,30 @@ struct AstIdentifier : public AstNode
 	AstIdentifier(std::string identifier, Location location) 
 		: AstNode(astNodeType_identifier, location)
 		, identifier(identifier)
+		, symbol(Symbols::intern(identifier))
 	{}
 
 	std::string identifier;
+	int symbol; // Used to find the global variable with that name without a lookup by name.
 };
 
 // AstNode representing the operation of acessing a member variable in a table(known as dictionaly or map in some languages).
 // Exmple: <expression>.<member> like point.x
 struct AstMemberAcess : public AstNode
 {
-	AstMemberAcess(AstNode* const left, const std::string& memberName, Location location)
+	AstMemberAcess(AstNode* const left, StringRef memberName, Location location)
 		: left(left)
 		, memberName(memberName)
 		, AstNode(astNodeType_memberAccess, location)
 	{}
 
 	AstNode* left = nullptr;
-	std::string memberName;
+	StringRef memberName; // Interned in the constant pool of the Parser, so the hash is computed only once.
+
+	// An inline cache filled by the Executor: the position of the member in the last table that was accessed (see Table::entryAt).
+	// Tables made by the same code have their members in the same order, so the member is usually found there without a lookup.
+	mutable uint32_t cachedEntryIndex = UINT32_MAX;
+	mutable uint8_t cacheMisses = 0; // Once too many, the site is concidered polymorphic and the cache isn't used anymore.
 };
 
 // AstNode representing a set of nodes used to create a table.
@@ -367,7 +893,7 @@ struct AstTableMaker : public AstNode
 		: AstNode(astNodeType_tableMaker, location)
 	{}
 
-	std::unordered_map<std::string, AstNode*> memberToExpression;
+	std::vector<std::pair<StringRef, AstNode*>> memberToExpression; // In the order of the source code.
 };
 
 // AstNode representing a set of nodes used to create an array.
@@ -384,6 +910,8 @@ struct AstArrayMaker : public AstNode
 // AstNode representing a function call.
 // The function is obtained by evaluating the expresion on the left of the '('
 // everything else, until the matching ')' is concidered a function argument.
+struct AstFnDecl;
+
 struct AstFnCall : public AstNode
 {
 	AstFnCall(Location location)
@@ -392,6 +920,12 @@ struct AstFnCall : public AstNode
 
 	AstNode* theFunction = nullptr; // The node that we are going to evaluate to obtain the function that we're going to call.
 	std::vector<AstNode*> callArgs; // The node that we are going to evalute in order to pass the parameters to the function.
+
+	// A monomorphic cache of the last function called here, its number of arguments is already validated.
+	// If that function got inlined (see Inliner), its body is evaluated in place of the call.
+	mutable const AstFnDecl* cachedFn = nullptr;
+	mutable const AstNode* inlinedBody = nullptr;
+	mutable uint8_t cacheMisses = 0;
 };
 
 // AstNode representing an array indexing.
@@ -407,12 +941,76 @@ struct AstArrayIndexing : public AstNode
 	AstNode* index = nullptr; // The node that we are going to evaluate to obtain the index.
 };
 
+// The arithmetic and comparison operations of AstBinOp. The token is translated once, so the evaluation could switch on it.
+enum BinOpOperation : uint8_t
+{
+	binOpOperation_none,
+	binOpOperation_add,
+	binOpOperation_sub,
+	binOpOperation_mul,
+	binOpOperation_div,
+	binOpOperation_equals,
+	binOpOperation_notEquals,
+	binOpOperation_lessEquals,
+	binOpOperation_greaterEquals,
+	binOpOperation_less,
+	binOpOperation_greater,
+};
+
+inline BinOpOperation toBinOpOperation(const TokenType op)
+{
+	switch(op) {
+		case tokenType_plus: return binOpOperation_add;
+		case tokenType_minus: return binOpOperation_sub;
+		case tokenType_asterisk: return binOpOperation_mul;
+		case tokenType_slash: return binOpOperation_div;
+		case tokenType_equals: return binOpOperation_equals;
+		case tokenType_notEquals: return binOpOperation_notEquals;
+		case tokenType_lessEquals: return binOpOperation_lessEquals;
+		case tokenType_greaterEquals: return binOpOperation_greaterEquals;
+		case tokenType_less: return binOpOperation_less;
+		case tokenType_greater: return binOpOperation_greater;
+		default: return binOpOperation_none;
+	}
+}
+
+// How a binary operation is evaluated. Operations whose operand types are proven ahead of time (see TypeInference)
+// use the specialized forms, which skip checking the types of the operands.
+enum BinOpForm : uint8_t
+{
+	binOpForm_generic, // Anything could come, the types are checked.
+	binOpForm_i64, // Both operands are integers.
+	binOpForm_f32, // Both operands are floats.
+	binOpForm_number, // Both operands are numbers, but either could be an integer or a float.
+	binOpForm_stringConcat, // string + string.
+	binOpForm_stringEquals, // string == string.
+
+	// The quickened forms, chosen by the Executor from the types that it observed (see Executor::recordBinOpFeedback).
+	// These check that the types are still the expected ones, and go back to the generic form if they aren't.
+	binOpForm_guardedI64,
+	binOpForm_guardedF32,
+	binOpForm_guardedNumber,
+	binOpForm_guardedStringConcat,
+	binOpForm_guardedStringEquals,
+};
+
+// The types of the operands seen by a generic binary operation.
+struct BinOpFeedback
+{
+	uint8_t leftType = 0; // VarType
+	uint8_t rightType = 0; // VarType
+	uint8_t hits = 0; // How many times in a row the same types were seen.
+	uint8_t deopts = 0; // How many times a quickened form failed its guard.
+	bool isDisabled = false; // The operation isn't going to be quickened anymore.
+};
+
 // A binary operation line  x + y, x * y and so on.
 struct AstBinOp : public AstNode
 {
 	AstBinOp(const TokenType op, AstNode* const left, AstNode* const right, Location location) 
 		: AstNode(astNodeType_binop, location)
 		, op(op)
+		, operation(toBinOpOperation(op))
 		, left(left)
 		, right(right)
 	{}
@@ -420,6 +1018,12 @@ struct AstBinOp : public AstNode
 	AstNode* left;
 	AstNode* right;
 	TokenType op; // The token type of the operation.
+	BinOpOperation operation;
+
+	// Proven by TypeInference or quickened by the Executor while running, that's why it is mutable.
+	// As the AST gets modified while executing, it must not be executed by multiple threads at once.
+	mutable BinOpForm form = binOpForm_generic;
+	mutable BinOpFeedback feedback;
 };
 
 // Unary operation like !x, -x, +x,
@@ -441,10 +1045,42 @@ struct AstAssign : public AstNode
 		: AstNode(astNodeType_assign, location)
 		, left(left)
 		, right(right)
-	{}
+	{
+		detectIncrement();
+	}
 
 	AstNode* left = nullptr;
 	AstNode* right = nullptr;
+
+	// True for the form x = x + <integer> (or -), which the Executor does in place.
+	bool isIncrement = false;
+	int64_t incrementStep = 0;
+
+private :
+
+	void detectIncrement() {
+		if(left->type != astNodeType_identifier || right->type != astNodeType_binop) {
+			return;
+		}
+
+		const AstBinOp* const binop = (AstBinOp*)right;
+		if(binop->operation != binOpOperation_add && binop->operation != binOpOperation_sub) {
+			return;
+		}
+
+		if(binop->left->type != astNodeType_identifier || binop->right->type != astNodeType_number
+			|| ((AstIdentifier*)binop->left)->identifier != ((AstIdentifier*)left)->identifier) {
+			return;
+		}
+
+		const AstNumber* const step = (AstNumber*)binop->right;
+		if(!step->isInteger || step->integerValue == INT64_MIN) {
+			return;
+		}
+
+		isIncrement = true;
+		incrementStep = (binop->operation == binOpOperation_add) ? step->integerValue : -step->integerValue;
+	}
 };
 
 struct AstStatementList : public AstNode
@@ -468,6 +1104,12 @@ struct AstIf : public AstNode
 	AstNode* falseBranchStatement = nullptr;
 };
 
+struct Var;
+struct Executor;
+
+// The body of a function compiled ahead of time (see AotModule). Returns the result of the function, or nullptr if there isn't one.
+typedef Var* (*AotCompiledFn)(Executor* exec);
+
 struct AstFnDecl : public AstNode
 {
 	AstFnDecl(Location location) :
@@ -476,7 +1118,26 @@ struct AstFnDecl : public AstNode
 
 	AstNode* fnBodyBlock = nullptr; // THe code of the function.
 	std::vector<std::string> argsNames;
+	std::vector<int> argsSymbols; // The symbols of argsNames (see Symbols).
 	int fnIdx = -1;
+
+	// The expression that replaces calls to this function when it is inlined, made on first use (see Inliner).
+	mutable AstNode* inlineBody = nullptr;
+	mutable bool isInlineBodyMade = false;
+
+	// Set if a module compiled ahead of time got loaded, used in place of evaluating fnBodyBlock.
+	AotCompiledFn compiledBody = nullptr;
+};
+
+// A reference to the argument of an inlined function, evaluates to the value passed at the call site.
+struct AstInlinedArgument : public AstNode
+{
+	AstInlinedArgument(const int index, Location location)
+		: AstNode(astNodeType_inlinedArgument, location)
+		, index(index)
+	{}
+
+	int index;
 };
 
 struct AstWhile : public AstNode
@@ -499,6 +1160,33 @@ struct AstFor : public AstNode
 	AstNode* expression = nullptr;
 	AstNode* postIterationExpression = nullptr;
 	AstNode* trueBranchStatement = nullptr;
+
+	// Set by detectCountedLoop for loops like: for i = 0; i < n; i = i + 1 {...}
+	// Such loops are executed with the counter and the bound resolved once, and compared without evaluating the condition.
+	const AstIdentifier* counter = nullptr;
+	const AstNode* bound = nullptr; // An identifier or an integer literal.
+	BinOpOperation counterComparison = binOpOperation_none;
+
+	void detectCountedLoop() {
+		if(expression == nullptr || postIterationExpression == nullptr) return;
+		if(expression->type != astNodeType_binop || postIterationExpression->type != astNodeType_assign) return;
+
+		const AstBinOp* const condition = (AstBinOp*)expression;
+		const AstAssign* const post = (AstAssign*)postIterationExpression;
+		if(condition->operation < binOpOperation_notEquals || !post->isIncrement) return;
+		if(condition->left->type != astNodeType_identifier) return;
+
+		const AstIdentifier* const conditionCounter = (AstIdentifier*)condition->left;
+		if(conditionCounter->identifier != ((AstIdentifier*)post->left)->identifier) return;
+
+		const bool isBoundSimple = condition->right->type == astNodeType_identifier
+			|| (condition->right->type == astNodeType_number && ((AstNumber*)condition->right)->isInteger);
+		if(!isBoundSimple) return;
+
+		counter = conditionCounter;
+		bound = condition->right;
+		counterComparison = condition->operation;
+	}
 };
 
 struct AstPrint : public AstNode
@@ -525,14 +1213,39 @@ struct AstReturn : public AstNode
 // Takes a list of tokens and produces an AST.
 struct Parser
 {
+	Parser() = default;
+	Parser(const Parser&) = delete;
+	Parser& operator=(const Parser&) = delete;
+
+	~Parser() {
+		for(auto& pair : m_stringConstants) {
+			StringBuffer::destroy(pair.second);
+		}
+	}
+
 	const Token* m_token = nullptr;
-	std::unordered_map<int, AstFnDecl*> m_fnIdx2fn;
+	std::vector<AstFnDecl*> m_functions; // Indexed by AstFnDecl::fnIdx.
+
+	// The constant pool of the program. Each distinct string literal is materialized only once,
+	// as an immortal buffer, so passing it around never touches its reference count.
+	std::unordered_map<std::string, StringBuffer*> m_stringConstants;
+
+	StringRef internStringConstant(const std::string& s) {
+		StringBuffer*& constant = m_stringConstants[s];
+		if(constant == nullptr) {
+			constant = StringBuffer::allocate(s.size());
+			memcpy(constant->chars, s.data(), s.size());
+			constant->isImmortal = true;
+		}
+
+		return StringRef(constant);
+	}
 
 	// Registers the specified AstFnDecl, and gives the function specified by it a unique id(in that case just an index in a Look-Up-Table).
-	// This id is used to identify the function and to perform function calls.
+	// This id is used to identify the function when printing it, function values point directly to the AstFnDecl.
 	void registerFunction(AstFnDecl* const fnDecl) {
-		fnDecl->fnIdx = m_fnIdx2fn.size();
-		m_fnIdx2fn[m_fnIdx2fn.size()] = fnDecl;
+		fnDecl->fnIdx = (int)m_functions.size();
+		m_functions.push_back(fnDecl);
 	}
 
 	// Parses the specified list of token stored in m_token array (assums that the last token is tokenType_endToken).
@@ -612,6 +1325,7 @@ struct Parser
 			astFor->postIterationExpression = parse_expression();
 
 			astFor->trueBranchStatement = parse_statement_block();
+			astFor->detectCountedLoop();
 
 			return astFor;
 		}
@@ -697,6 +1411,7 @@ struct Parser
 			match(tokenType_lparen);
 			while(m_token->type == tokenType_identifier) {
 				fnDecl->argsNames.push_back(m_token->strData);
+				fnDecl->argsSymbols.push_back(Symbols::intern(m_token->strData));
 				match(tokenType_identifier);
 
 				if(m_token->type == tokenType_comma) {
@@ -726,16 +1441,17 @@ struct Parser
 		{
 			// { identifer = expression; ... }
 			if(m_token->type == tokenType_identifier) {
-				AstNode*& memberInitExpr = result->memberToExpression[m_token->strData];
+				const StringRef memberName = internStringConstant(m_token->strData);
 				match(tokenType_identifier);
 				match(tokenType_assign);
-				memberInitExpr = parse_expression();
+				AstNode* const memberInitExpr = parse_expression();
 
 				if(!memberInitExpr) {
 					ThrowError(m_token->location, "Failed to parse for loop init expression");
 					return nullptr;
 				}	
 
+				result->memberToExpression.emplace_back(memberName, memberInitExpr);
 				match(tokenType_semicolon);
 			} else {
 				ThrowError(m_token->location, "Expected an identifier for member initialization when creating a table");
@@ -771,12 +1487,14 @@ struct Parser
 		AstNode* left = nullptr;
 		if(m_token->type == tokenType_number)
 		{
-			left = new AstNumber(m_token->numberData, m_token->location);
+			left = m_token->isIntegerNumber
+				? new AstNumber(m_token->integerData, m_token->location)
+				: new AstNumber(m_token->numberData, m_token->location);
 			match(tokenType_number);
 		}
 		else if(m_token->type == tokenType_string)
 		{
-			left = new AstString(m_token->strData, m_token->location);
+			left = new AstString(internStringConstant(m_token->strData), m_token->location);
 			match(tokenType_string);
 		}
 		else if(m_token->type == tokenType_identifier)
@@ -853,7 +1571,7 @@ struct Parser
 			{
 				match(tokenType_dot);
 				assert(m_token->strData.size() > 0);
-				AstMemberAcess* const memberAcess = new AstMemberAcess(left, m_token->strData, m_token->location);
+				AstMemberAcess* const memberAcess = new AstMemberAcess(left, internStringConstant(m_token->strData), m_token->location);
 				match(tokenType_identifier);
 				left = memberAcess;
 			}
@@ -1010,662 +1728,6370 @@ struct Parser
 };
 
 //-----------------------------------------------------------------------------------------------------
-// The Executor (also know as Interpreter or Virtual Machine) and all the data that is needed to
-// execute our script.
+// Static analysis of the AST, done once before executing it.
 //-----------------------------------------------------------------------------------------------------
 
-// An enum describing all posible variable types that out language could handle.
-enum VarType : int
+// The types that the static type inference could prove for an expression.
+enum InferredType : uint8_t
 {
-	varType_undefined,
-	varType_table,
-	varType_array,
-	varType_f32,
-	varType_string,
-	varType_fn,
-	varType_fnNative, // A C++ function basically.
+	inferredType_unknown,
+	inferredType_i64,
+	inferredType_f32,
+	inferredType_number, // An integer or a float.
+	inferredType_string,
 };
 
-// A common typedef used for interop between the scrpting language and C++.
-// Example usages are: array_size array_push array_pop functions in the language.
-struct Var;
-struct Executor;
-typedef int (*NativeFnPtr)(int argc, Var* argv[], Executor* exec, Var** ppResultVariable);
-
-// The strcture that represents a single value(and variable) while executing the script.
-struct Var
+// A local, flow-sensitive type inference over the AST, run once after parsing.
+// It tracks the types of the variables assigned along the way and rewrites the binary operations
+// whose operands are proven to always be numbers or always be strings into specialized forms (see BinOpForm).
+// The facts about the variables are dropped conservatively:
+// - on function calls, as with dynamic scoping the called function could assign to any of our variables;
+// - when leaving a block, for the variables that were first assigned in it (they live in the scope of the block);
+// - where control flow merges (if branches and loop heads) the types are joined.
+// Function bodies are analyzed on their own, nothing is known about the arguments.
+struct TypeInference
 {
-	Var(VarType const varType = varType_undefined)
-		: m_varType(varType)
-	{
-		if(varType == varType_table) {
-			m_tableLUT = std::make_shared<std::unordered_map<std::string, Var>>();
-		}
+	typedef std::unordered_map<std::string, InferredType> Facts;
 
-		if(varType == varType_array) {
-			m_arrayValues = std::make_shared<std::vector<Var>>();
-		}
+	void run(AstNode* const root) {
+		Facts facts;
+		analyze(root, facts);
 	}
 
-	// TODO: These are kind of redundant and can be removed with a bit of work.
-	void makeFloat32(const float value) {
-		*this = Var(varType_f32);
-		m_value_f32 = value;
-	}
+private :
 
-	void makeString(std::string s) {
-		*this = Var(varType_string);
-		m_value_string = std::move(s);
+	static InferredType join(const InferredType a, const InferredType b) {
+		if(a == b) return a;
+		if(isNumber(a) && isNumber(b)) return inferredType_number;
+		return inferredType_unknown;
 	}
 
-	void makeTable() {
-		*this = Var(varType_table);
+	static bool isNumber(const InferredType t) {
+		return t == inferredType_i64 || t == inferredType_f32 || t == inferredType_number;
 	}
 
-	void makeArray() {
-		*this = Var(varType_array);
+	// Keeps only the variables known in both, with their types joined.
+	static Facts joinFacts(const Facts& a, const Facts& b) {
+		Facts result;
+		for(const auto& pair : a) {
+			auto itr = b.find(pair.first);
+			if(itr != b.end()) {
+				const InferredType t = join(pair.second, itr->second);
+				if(t != inferredType_unknown) {
+					result[pair.first] = t;
+				}
+			}
+		}
+		return result;
 	}
 
-	void makeFunction(int functionIndex) {
-		*this = Var(varType_fn);
-		m_fnIdx = functionIndex;
+	// The variables that were first assigned in a block are not visible after it.
+	static void leaveBlock(Facts& facts, const Facts& atEntry) {
+		for(auto itr = facts.begin(); itr != facts.end(); ) {
+			if(atEntry.count(itr->first) == 0) {
+				itr = facts.erase(itr);
+			} else {
+				++itr;
+			}
+		}
 	}
 
-	void makeNativeFunction(NativeFnPtr const nativeFn) {
-		*this = Var(varType_fnNative);
-		m_fnNative = nativeFn;
+	static void setFact(Facts& facts, const std::string& name, const InferredType t) {
+		if(t == inferredType_unknown) {
+			facts.erase(name);
+		} else {
+			facts[name] = t;
+		}
 	}
 
-public :
-
-	VarType m_varType = varType_undefined;
+	void analyzeBlock(AstNode* const node, Facts& facts) {
+		const Facts atEntry = facts;
+		analyze(node, facts);
+		leaveBlock(facts, atEntry);
+	}
 
-	// The data that could be used depending on the type of the variable:
-	float m_value_f32 = 0.f; // A float representing a number in our language.
-	int m_fnIdx = -1;  // An int containing the function id of the function that we point to (see registerFunction).
-	NativeFnPtr m_fnNative = nullptr; // Used to enable our script to call native C++ functions via that function-pointer typedef.
-	std::string m_value_string; // A std::string for strings in our language.
+	// Analyzes a loop. The facts at the loop head are the facts before the loop joined with the facts after each iteration,
+	// they are found by iterating without rewriting anything and only then the loop is analyzed for real.
+	void analyzeLoop(AstNode* const condition, AstNode* const body, AstNode* const postIteration, Facts& facts) {
+		const bool shouldRewrite = m_shouldRewrite;
+		m_shouldRewrite = false;
 
-	// These two are shared_ptrs in order to replicate the bahiavior that is used in JavaScript.
-	// When we pass these around we pass them by reference (all other types are by value).
-	std::shared_ptr<std::unordered_map<std::string, Var>> m_tableLUT; // If this variable is a table, holds names and values of all of its members.
-	std::shared_ptr<std::vector<Var>> m_arrayValues; // If this is an array, hold the member values for each index.
-};
+		Facts head = facts;
+		while(true) {
+			Facts iteration = head;
+			analyze(condition, iteration);
+			analyzeBlock(body, iteration);
+			analyze(postIteration, iteration);
 
-// Just a function that prints the type and value of the specified variable to std::out.
-void printVariable(const Var* const expr)
-{
-	if(expr->m_varType == varType_f32)
-		printf("%f\n", expr->m_value_f32);
-	else if(expr->m_varType == varType_string)
-		printf("%s\n", expr->m_value_string.c_str());
-	else if(expr->m_varType == varType_fn)
-		printf("<function %i>\n", expr->m_fnIdx);
-	else if(expr->m_varType == varType_table)
-	{
-		printf("{ \n");
-		if(expr->m_tableLUT)
-		for(auto& pair : *expr->m_tableLUT)
-		{
-			printf("%s = ", pair.first.c_str());
-			printVariable(&pair.second);
-			
-		}
-		printf(" }\n");
-	}
-	else if(expr->m_varType == varType_array)
-	{
-		printf("[ \n");
-		if(expr->m_arrayValues)
-			for(const Var& var : *expr->m_arrayValues)
-			{
-				printVariable(&var);
+			Facts newHead = joinFacts(head, iteration);
+			if(newHead == head) {
+				break;
 			}
-		printf(" ]\n");
-	}
-	else
-		printf("<undefined>\n");
-};
+			head = std::move(newHead);
+		}
 
-// Represents a 'scope' in our language. Each function or a block create it's own scope
-// in order to enable us to have colliding variable names.
-// Even if the variables are in different functions we still need this scope.
-// In our case, depending on the current block, we just amend all scopes (the currenct scope is stored in an array).,
-// at the begining of the variable name - this is name collisions are resolved.
-struct Scope
-{
-	std::string scope;
-};
+		m_shouldRewrite = shouldRewrite;
+		if(m_shouldRewrite) {
+			Facts iteration = head;
+			analyze(condition, iteration);
+			analyzeBlock(body, iteration);
+			analyze(postIteration, iteration);
+		}
 
-// The executor itself.
-// Takes and AST node and executes.
-struct Executor
-{
-	Executor() {
-		addStnadardLibFunctions();
+		// The loop is left after evaluating the condition.
+		facts = std::move(head);
+		analyze(condition, facts);
 	}
 
-	void pushScope(const AstNode* const node, const char* const postfix)
-	{
-		std::stringstream uniqueIdSS;
-		uniqueIdSS << (size_t)(AstNode*)node;
-		if(postfix) {
-			uniqueIdSS << postfix;
+	InferredType analyze(AstNode* const root, Facts& facts) {
+		if(root == nullptr) {
+			return inferredType_unknown;
 		}
 
-		std::string fullScope = !m_scopeStack.empty() 
-			? m_scopeStack.back() + " " + uniqueIdSS.str()
-			: uniqueIdSS.str();
+		switch(root->type)
+		{
+			case astNodeType_number:
+				return ((AstNumber*)root)->isInteger ? inferredType_i64 : inferredType_f32;
+			case astNodeType_string:
+				return inferredType_string;
+			case astNodeType_identifier:
+			{
+				auto itr = facts.find(((AstIdentifier*)root)->identifier);
+				return itr != facts.end() ? itr->second : inferredType_unknown;
+			}
+			case astNodeType_memberAccess:
+				analyze(((AstMemberAcess*)root)->left, facts);
+				return inferredType_unknown;
+			case astNodeType_tableMaker:
+				for(const auto& pair : ((AstTableMaker*)root)->memberToExpression) {
+					analyze(pair.second, facts);
+				}
+				return inferredType_unknown;
+			case astNodeType_arrayMaker:
+				for(AstNode* const expr : ((AstArrayMaker*)root)->arrayElements) {
+					analyze(expr, facts);
+				}
+				return inferredType_unknown;
+			case astNodeType_binop:
+			{
+				AstBinOp* const n = (AstBinOp*)root;
+				const InferredType left = analyze(n->left, facts);
+				const InferredType right = analyze(n->right, facts);
+				return analyzeBinOp(n, left, right);
+			}
+			case astNodeType_unop:
+			{
+				const AstUnOp* const n = (AstUnOp*)root;
+				const InferredType operand = analyze(n->left, facts);
+				if(n->op == tokenType_not) return inferredType_i64;
+				if(operand == inferredType_i64) return n->op == tokenType_plus ? inferredType_i64 : inferredType_number;
+				return isNumber(operand) ? operand : inferredType_unknown;
+			}
+			case astNodeType_fnCall:
+			{
+				AstFnCall* const n = (AstFnCall*)root;
+				analyze(n->theFunction, facts);
+				for(AstNode* const arg : n->callArgs) {
+					analyze(arg, facts);
+				}
+				facts.clear();
+				return inferredType_unknown;
+			}
+			case astNodeType_arrayIndexing:
+			{
+				AstArrayIndexing* const n = (AstArrayIndexing*)root;
+				analyze(n->theArray, facts);
+				analyze(n->index, facts);
+				return inferredType_unknown;
+			}
+			case astNodeType_assign:
+			{
+				AstAssign* const n = (AstAssign*)root;
+				if(n->left->type == astNodeType_identifier) {
+					const InferredType right = analyze(n->right, facts);
+					setFact(facts, ((AstIdentifier*)n->left)->identifier, right);
+					return right;
+				}
 
-		m_scopeStack.emplace_back(std::move(fullScope));
-	}
+				analyze(n->left, facts);
+				return analyze(n->right, facts);
+			}
+			case astNodeType_statementList:
+			{
+				AstStatementList* const n = (AstStatementList*)root;
+				const Facts atEntry = facts;
+				InferredType result = inferredType_unknown;
+				for(AstNode* const statement : n->m_statements) {
+					result = analyze(statement, facts);
+				}
 
-	void popScope()
-	{
-		if(m_scopeStack.empty()) {
-			ThrowError(Location(), "Internal Error: Wrong scope pop");
+				if(n->needsOwnScope) {
+					leaveBlock(facts, atEntry);
+				}
+				return result;
+			}
+			case astNodeType_if:
+			{
+				AstIf* const n = (AstIf*)root;
+				analyze(n->expression, facts);
+
+				Facts trueFacts = facts;
+				analyzeBlock(n->trueBranchStatement, trueFacts);
+				analyzeBlock(n->falseBranchStatement, facts);
+				facts = joinFacts(trueFacts, facts);
+				return inferredType_unknown;
+			}
+			case astNodeType_while:
+			{
+				AstWhile* const n = (AstWhile*)root;
+				const Facts atEntry = facts;
+				analyzeLoop(n->expression, n->trueBranchStatement, nullptr, facts);
+				leaveBlock(facts, atEntry);
+				return inferredType_unknown;
+			}
+			case astNodeType_for:
+			{
+				AstFor* const n = (AstFor*)root;
+				const Facts atEntry = facts;
+				analyze(n->initExpression, facts);
+				analyzeLoop(n->expression, n->trueBranchStatement, n->postIterationExpression, facts);
+				leaveBlock(facts, atEntry);
+				return inferredType_unknown;
+			}
+			case astNodeType_print:
+				analyze(((AstPrint*)root)->expression, facts);
+				return inferredType_unknown;
+			case astNodeType_return:
+				analyze(((AstReturn*)root)->expression, facts);
+				return inferredType_unknown;
+			case astNodeType_fndecl:
+			{
+				// The body runs when the function is called, not here. It only needs to be analyzed once.
+				if(m_shouldRewrite) {
+					Facts bodyFacts;
+					analyze(((AstFnDecl*)root)->fnBodyBlock, bodyFacts);
+				}
+				return inferredType_unknown;
+			}
+			default:
+				return inferredType_unknown;
 		}
-		m_scopeStack.pop_back();
 	}
 
-	Var* newVariableRaw(const char* nameCStr, const VarType varType) {
-		
-		Var* const result = new Var(varType);
-		
-		if(nameCStr!=nullptr) {
-			//result->m_name = name;
-			m_variablesLut[nameCStr] = result;
+	InferredType analyzeBinOp(AstBinOp* const n, const InferredType left, const InferredType right) {
+		const bool isComparison = n->operation >= binOpOperation_equals;
+
+		if(isNumber(left) && isNumber(right) && n->operation != binOpOperation_none) {
+			if(m_shouldRewrite) {
+				if(left == inferredType_i64 && right == inferredType_i64) n->form = binOpForm_i64;
+				else if(left == inferredType_f32 && right == inferredType_f32) n->form = binOpForm_f32;
+				else n->form = binOpForm_number;
+			}
+
+			// Integer arithmetic could overflow into a float, anything mixed with a float is a float.
+			if(isComparison) return inferredType_i64;
+			if(left == inferredType_f32 || right == inferredType_f32) return inferredType_f32;
+			return inferredType_number;
 		}
-		return result;
-	}
 
-	Var* newVariableFloat(float v) {
-		Var* var = newVariableRaw(nullptr, (VarType)0); // HACK
-		var->makeFloat32(v);
-		return var;
-	}
+		if(left == inferredType_string && right == inferredType_string && m_shouldRewrite) {
+			if(n->operation == binOpOperation_add) n->form = binOpForm_stringConcat;
+			else if(n->operation == binOpOperation_equals) n->form = binOpForm_stringEquals;
+		}
 
-	Var* newVariableString(std::string v) {
-		Var* var = newVariableRaw(nullptr, (VarType)0);
-		var->makeString(std::move(v));
-		return var;
+		// Otherwise the operation either fails or produces these.
+		if(isComparison) return inferredType_i64;
+		if(n->operation == binOpOperation_add && (left == inferredType_string || right == inferredType_string)) return inferredType_string;
+		return inferredType_unknown;
 	}
 
-	Var* newVariableFunction(int fnIdx) {
-		Var* var = newVariableRaw(nullptr, (VarType)0);
-		var->makeFunction(fnIdx);
-		return var;
-	}
+	bool m_shouldRewrite = true;
+};
 
-	Var* newVariableNativeFunction(const char* name, NativeFnPtr fnPtr) {
-		Var* var = newVariableRaw(name, (VarType)0);
-		var->makeNativeFunction(fnPtr);
-		return var;
+// Makes the small functions inlinable.
+// A function is inlined when its body is a single return of an expression that uses only its arguments, literals,
+// operators, member accesses and array indexing, and has at most kMaxNodes nodes. Such a function has no side effects
+// other than the ones of the operations themselves, doesn't call anything (so it isn't recursive) and doesn't depend on the scope
+// it is executed in, so evaluating the expression with the arguments substituted is the same as calling it.
+// The call sites check that they still call the same function before using the inlined body (see Executor, astNodeType_fnCall).
+struct Inliner
+{
+	static const int kMaxNodes = 16;
+	static const int kMaxArguments = 8;
+
+	// Returns the expression to evaluate instead of calling the function, or nullptr if it can't be inlined.
+	static const AstNode* getInlineBody(const AstFnDecl* const fnDecl) {
+		if(!fnDecl->isInlineBodyMade) {
+			fnDecl->isInlineBodyMade = true;
+			fnDecl->inlineBody = makeInlineBody(fnDecl);
+		}
+		return fnDecl->inlineBody;
 	}
 
-	Var* findVariableInScope(const std::string& baseName, bool createUndefinedIfMissing, bool shouldGoUpwardsIfMIssing) {
+private :
 
-		for(int t = (int)(m_scopeStack.size()) - 1; t != -2; --t)
-		{
-			std::string name = (t == -1) ? baseName : m_scopeStack[t] + " " + baseName;;
-		
-			auto itr = m_variablesLut.find(name);
-			if(itr == std::end(m_variablesLut)) {
+	static AstNode* makeInlineBody(const AstFnDecl* const fnDecl) {
+		if(fnDecl->argsNames.size() > kMaxArguments || fnDecl->fnBodyBlock == nullptr || fnDecl->fnBodyBlock->type != astNodeType_statementList) {
+			return nullptr;
+		}
 
-				if(createUndefinedIfMissing) {
-					return newVariableRaw(name.c_str(), varType_undefined);
-				}
-			} else {
-				return itr->second;
-			}
+		const AstStatementList* const body = (AstStatementList*)fnDecl->fnBodyBlock;
+		if(body->m_statements.size() != 1 || body->m_statements[0]->type != astNodeType_return) {
+			return nullptr;
+		}
 
-			if(shouldGoUpwardsIfMIssing == false)
-				return nullptr;
+		const AstReturn* const ret = (AstReturn*)body->m_statements[0];
+		if(ret->expression == nullptr) {
+			return nullptr;
 		}
 
-		return nullptr;
+		int budget = kMaxNodes;
+		return clone(ret->expression, fnDecl->argsNames, budget);
 	}
 
-	struct EvalCtx
-	{
-		Var* forcedResult = nullptr; // used by return statements to pass the result.
-	};
-
-	Var* evaluate(const AstNode* const root, EvalCtx& ctx)
-	{
-		if(ctx.forcedResult != nullptr) {
-			return ctx.forcedResult;
+	// Copies the expression, replacing the arguments with AstInlinedArgument. Returns nullptr if something can't be inlined.
+	static AstNode* clone(const AstNode* const node, const std::vector<std::string>& argsNames, int& budget) {
+		if(node == nullptr || --budget < 0) {
+			return nullptr;
 		}
 
-		switch(root->type)
+		switch(node->type)
 		{
 			case astNodeType_number:
-			{   
-				return newVariableFloat(((AstNumber*)(root))->value);
-			}break;
+			{
+				const AstNumber* const n = (AstNumber*)node;
+				return n->isInteger ? new AstNumber(n->integerValue, n->location) : new AstNumber(n->value, n->location);
+			}
 			case astNodeType_string:
-			{   
-				return newVariableString(((AstString*)(root))->value); // string
-			}break;
+				return new AstString(((AstString*)node)->value, node->location);
 			case astNodeType_identifier:
 			{
-				const AstIdentifier* const n = (AstIdentifier*)root;
-				Var* result = findVariableInScope(n->identifier, false, true);
-				if(!result) {
-					result = findVariableInScope(n->identifier, true, false);
+				const std::string& name = ((AstIdentifier*)node)->identifier;
+				for(size_t t = 0; t < argsNames.size(); ++t) {
+					if(argsNames[t] == name) {
+						return new AstInlinedArgument((int)t, node->location);
+					}
 				}
-				return result;
-			}break;
-			case astNodeType_fndecl:
+				return nullptr; // Anything else depends on the scope.
+			}
+			case astNodeType_binop:
 			{
-				const AstFnDecl* const n = (AstFnDecl*)root;
-				Var* const result = newVariableFunction(n->fnIdx);
-				return result;
-			}break;
-			case astNodeType_memberAccess:
+				const AstBinOp* const n = (AstBinOp*)node;
+				AstNode* const left = clone(n->left, argsNames, budget);
+				AstNode* const right = left ? clone(n->right, argsNames, budget) : nullptr;
+				return right ? new AstBinOp(n->op, left, right, n->location) : nullptr;
+			}
+			case astNodeType_unop:
 			{
-				const AstMemberAcess* const n = (AstMemberAcess*)root;
-				Var* const left = evaluate(n->left, ctx);
-
-				if(left->m_varType != varType_table || !left->m_tableLUT) {
-					ThrowError(n->location, "Only tables have members");
-					return nullptr;
-				}
-
-				Var member;
-
-				auto itr = (*left->m_tableLUT).find(n->memberName);
-				if(itr == std::end(*left->m_tableLUT))
-				{
-					(*left->m_tableLUT)[n->memberName] = Var();
-					return &(*left->m_tableLUT)[n->memberName];
-				}
-				else
-				{
-					return &itr->second;
-				}
-				
-			}break;
-			case astNodeType_tableMaker:
+				const AstUnOp* const n = (AstUnOp*)node;
+				AstNode* const operand = clone(n->left, argsNames, budget);
+				return operand ? new AstUnOp(n->op, operand, n->location) : nullptr;
+			}
+			case astNodeType_memberAccess:
 			{
-				const AstTableMaker* const n = (AstTableMaker*)root;
-				Var* result = newVariableRaw(nullptr, varType_table);
-				for(const auto& pair : n->memberToExpression)
-				{
-					(*result->m_tableLUT)[pair.first] = *evaluate(pair.second, ctx);
-				}
-
-				return result;
-			}break;
-			case astNodeType_arrayMaker:
+				const AstMemberAcess* const n = (AstMemberAcess*)node;
+				AstNode* const left = clone(n->left, argsNames, budget);
+				return left ? new AstMemberAcess(left, n->memberName, n->location) : nullptr;
+			}
+			case astNodeType_arrayIndexing:
 			{
-				const AstArrayMaker* const n = (AstArrayMaker*)root;
-				Var* result = newVariableRaw(nullptr, varType_array);
-				for(const AstNode* const expr : n->arrayElements)
-				{
-					 ;
-					(*result->m_arrayValues).push_back(*evaluate(expr, ctx));
+				const AstArrayIndexing* const n = (AstArrayIndexing*)node;
+				AstNode* const theArray = clone(n->theArray, argsNames, budget);
+				AstNode* const index = theArray ? clone(n->index, argsNames, budget) : nullptr;
+				if(index == nullptr) {
+					return nullptr;
 				}
 
+				AstArrayIndexing* const result = new AstArrayIndexing(n->location);
+				result->theArray = theArray;
+				result->index = index;
 				return result;
-			}break;
-			case astNodeType_binop:
-			{
-				const AstBinOp* const n = (AstBinOp*)root;
-				const Var* const left = evaluate(n->left, ctx);
-				const Var* const right = evaluate(n->right, ctx);
+			}
+			default:
+				return nullptr;
+		}
+	}
+};
 
-				if(left->m_varType == varType_f32 && right->m_varType == varType_f32)
+//-----------------------------------------------------------------------------------------------------
+// The Executor (also know as Interpreter or Virtual Machine) and all the data that is needed to
+// execute our script.
+//-----------------------------------------------------------------------------------------------------
+
+// An enum describing all posible variable types that out language could handle.
+enum VarType : int
+{
+	varType_undefined,
+	varType_table,
+	varType_array,
+	varType_f32,
+	varType_i64,
+	varType_string,
+	varType_fn,
+	varType_fnNative, // A C++ function basically.
+};
+
+// A common typedef used for interop between the scrpting language and C++.
+// Example usages are: array_size array_push array_pop functions in the language.
+struct Var;
+struct Executor;
+struct Table;
+struct Array;
+typedef int (*NativeFnPtr)(int argc, Var* argv[], Executor* exec, Var** ppResultVariable);
+
+// The strcture that represents a single value(and variable) while executing the script.
+struct Var
+{
+	// Note that tables and arrays live in the garbage collected heap, so they are created by the Executor (see newVariableRaw).
+	Var(VarType const varType = varType_undefined)
+		: m_varType(varType)
+	{}
+
+	// TODO: These are kind of redundant and can be removed with a bit of work.
+	void makeFloat32(const float value) {
+		*this = Var(varType_f32);
+		m_value_f32 = value;
+	}
+
+	void makeInt64(const int64_t value) {
+		*this = Var(varType_i64);
+		m_value_i64 = value;
+	}
+
+	bool isNumber() const {
+		return m_varType == varType_f32 || m_varType == varType_i64;
+	}
+
+	// The value of a number as a float, integers are converted.
+	float asFloat32() const {
+		return m_varType == varType_i64 ? (float)m_value_i64 : m_value_f32;
+	}
+
+	// Used by the conditions of if, while and for. Only non-zero numbers are true.
+	bool isTrue() const {
+		return (m_varType == varType_i64) ? m_value_i64 != 0 : m_value_f32 != 0.f;
+	}
+
+	void makeString(StringRef s) {
+		*this = Var(varType_string);
+		m_value_string = std::move(s);
+	}
+
+	void makeFunction(const AstFnDecl* const fnDecl) {
+		*this = Var(varType_fn);
+		m_fnDecl = fnDecl;
+	}
+
+	void makeNativeFunction(NativeFnPtr const nativeFn) {
+		*this = Var(varType_fnNative);
+		m_fnNative = nativeFn;
+	}
+
+public :
+
+	VarType m_varType = varType_undefined;
+
+	// The data that could be used depending on the type of the variable:
+	float m_value_f32 = 0.f; // A float representing a number in our language.
+	int64_t m_value_i64 = 0; // An integer number in our language. Operations on integers that overflow produce floats.
+	const AstFnDecl* m_fnDecl = nullptr; // The declaration of the function that we point to, owned by the AST.
+	NativeFnPtr m_fnNative = nullptr; // Used to enable our script to call native C++ functions via that function-pointer typedef.
+	StringRef m_value_string; // A shared immutable buffer for strings in our language.
+
+	// These two point to objects owned by the garbage collector in order to replicate the bahiavior that is used in JavaScript.
+	// When we pass these around we pass them by reference (all other types are by value).
+	Table* m_table = nullptr; // If this variable is a table, holds names and values of all of its members.
+	Array* m_array = nullptr; // If this is an array, hold the member values for each index.
+};
+
+//-----------------------------------------------------------------------------------------------------
+// The garbage collected heap.
+// Tables, arrays and the Var cells created by the Executor (variables and temporaries) are owned by the Heap.
+// The collector is an incremental mark-sweep one. A collection cycle is started once enough memory was allocated
+// and it is performed in small steps at safe points (between statements and loop iterations) to keep the pauses short.
+// The marking uses a snapshot-at-the-beginning write barrier: while marking, every value that gets overwritten is shaded
+// (see Heap::writeBarrier), and everything allocated during marking is considered alive.
+//
+// Values refer to heap objects with plain pointers, there is no reference counting (atomic or not) when they are copied.
+// This is only possible because a Heap (and the Executor that owns it) is used by a single thread at a time:
+// - The thread that creates the Heap owns it. Another thread could take it over only while no script is running (see Heap::bindToCurrentThread).
+// - Objects never cross heaps directly. A graph of values is moved with Heap::detachGraph, which empties the source
+//   tables and arrays (the sender loses access, even through other references) and gives a HeapTransfer that references nothing
+//   in the source heap. The HeapTransfer could be passed to any thread and adopted by another heap with Heap::adoptGraph (see Channel).
+// - Strings have non atomic reference counts too, so detachGraph gives the transfer its own copy of every string that is shared.
+//-----------------------------------------------------------------------------------------------------
+
+enum GcObjectType : int
+{
+	gcObjectType_table,
+	gcObjectType_array,
+};
+
+// The base of every object in the heap that could reference other objects.
+struct GcObject
+{
+	GcObject(GcObjectType const gcType)
+		: gcType(gcType)
+	{}
+
+	virtual ~GcObject() = default;
+
+	GcObject* gcNext = nullptr; // The next object in the list of all objects owned by the heap.
+	GcObjectType gcType;
+	bool gcIsMarked = false;
+};
+
+// A single member of a table.
+struct TableEntry
+{
+	StringRef key;
+	Var value;
+};
+
+// The storage behind the tables in our language.
+// Most tables are small, so the first entries are stored in the same allocation as the table itself and are found with a linear scan.
+// Once the table grows above kMaxLinearSize members, an open addressing index is built over the entries.
+// The index is a swiss-table like one: a control byte with 7 bits of the hash for each slot,
+// 16 of them are checked at once with SSE2 when probing.
+// Members are never removed and entries never move once added (they are appended to chunks of growing size),
+// so the Executor could hold pointers to member values like it does for any other variable.
+struct Table : public GcObject
+{
+	// Tables are variable sized (see inlineEntries), use Table::create.
+	static Table* create(const size_t expectedSize) {
+		const uint32_t inlineCapacity = (uint32_t)std::max<size_t>(expectedSize, kMinInlineCapacity);
+		void* const memory = ::operator new(sizeof(Table) + inlineCapacity * sizeof(TableEntry));
+		return new(memory) Table(inlineCapacity);
+	}
+
+	static void operator delete(void* const memory) {
+		::operator delete(memory);
+	}
+
+	~Table() {
+		clear();
+	}
+
+	size_t size() const { return m_size; }
+
+	// The approximate memory used by the table, used by the garbage collector.
+	size_t memoryBytes() const {
+		size_t bytes = sizeof(Table) + m_inlineCapacity * sizeof(TableEntry) + m_indexCapacity * (1 + sizeof(TableEntry*));
+		for(const Chunk& chunk : m_chunks) {
+			bytes += chunk.capacity * sizeof(TableEntry);
+		}
+		return bytes;
+	}
+
+	Var* find(const StringRef& key) {
+		TableEntry* const entry = findEntry(key);
+		return entry ? &entry->value : nullptr;
+	}
+
+	// Returns the value of the specified member, adding it (as undefined) if it is missing.
+	Var* findOrInsert(const StringRef& key) {
+		return &findOrInsertEntry(key)->value;
+	}
+
+	TableEntry* findOrInsertEntry(const StringRef& key) {
+		if(TableEntry* const entry = findEntry(key)) {
+			return entry;
+		}
+
+		TableEntry* const entry = new(appendEntrySlot()) TableEntry();
+		entry->key = key;
+		m_size++;
+
+		if(m_size > kMaxLinearSize) {
+			if((m_size + 1) * 8 > m_indexCapacity * 7) {
+				rebuildIndex();
+			} else {
+				insertIntoIndex(entry);
+			}
+		}
+
+		return entry;
+	}
+
+	// Returns the member that was added @index-th.
+	TableEntry* entryAt(size_t index) const {
+		assert(index < m_size);
+		if(index < m_inlineCapacity) {
+			return inlineEntries() + index;
+		}
+
+		index -= m_inlineCapacity;
+		for(const Chunk& chunk : m_chunks) {
+			if(index < chunk.capacity) {
+				return chunk.entries + index;
+			}
+			index -= chunk.capacity;
+		}
+		return nullptr;
+	}
+
+	// The opposite of entryAt, returns the position of @entry in the order that the members were added.
+	uint32_t indexOfEntry(const TableEntry* const entry) const {
+		const TableEntry* const inlineBegin = inlineEntries();
+		if(entry >= inlineBegin && entry < inlineBegin + m_inlineCapacity) {
+			return (uint32_t)(entry - inlineBegin);
+		}
+
+		uint32_t index = m_inlineCapacity;
+		for(const Chunk& chunk : m_chunks) {
+			if(entry >= chunk.entries && entry < chunk.entries + chunk.capacity) {
+				return index + (uint32_t)(entry - chunk.entries);
+			}
+			index += chunk.capacity;
+		}
+
+		assert(false);
+		return UINT32_MAX;
+	}
+
+	// Calls @fn(TableEntry&) for each member, in the order that they were added.
+	template<typename TFn>
+	void forEach(TFn&& fn) const {
+		size_t remaining = m_size;
+
+		const size_t inlineCount = std::min<size_t>(remaining, m_inlineCapacity);
+		for(size_t t = 0; t < inlineCount; ++t) {
+			fn(inlineEntries()[t]);
+		}
+		remaining -= inlineCount;
+
+		for(const Chunk& chunk : m_chunks) {
+			const size_t count = std::min<size_t>(remaining, chunk.capacity);
+			for(size_t t = 0; t < count; ++t) {
+				fn(chunk.entries[t]);
+			}
+			remaining -= count;
+		}
+	}
+
+	// Moves all members of @source into this table, @source is left empty.
+	void moveEntriesFrom(Table& source) {
+		source.forEach([this](TableEntry& entry) {
+			*findOrInsert(entry.key) = std::move(entry.value);
+		});
+		source.clear();
+	}
+
+	void clear() {
+		forEach([](TableEntry& entry) { entry.~TableEntry(); });
+
+		for(const Chunk& chunk : m_chunks) {
+			::operator delete(chunk.entries);
+		}
+		m_chunks.clear();
+
+		delete[] m_indexControl;
+		delete[] m_indexSlots;
+		m_indexControl = nullptr;
+		m_indexSlots = nullptr;
+		m_indexCapacity = 0;
+		m_size = 0;
+	}
+
+private :
+
+	struct Chunk
+	{
+		TableEntry* entries;
+		uint32_t capacity;
+	};
+
+	static constexpr uint32_t kMinInlineCapacity = 4;
+	static constexpr uint32_t kMaxLinearSize = 8;
+	static constexpr uint32_t kGroupSize = 16;
+	static constexpr uint8_t kControlEmpty = 0x80;
+
+	explicit Table(const uint32_t inlineCapacity)
+		: GcObject(gcObjectType_table)
+		, m_inlineCapacity(inlineCapacity)
+	{}
+
+	TableEntry* inlineEntries() const {
+		return (TableEntry*)(this + 1);
+	}
+
+	static uint8_t controlFromHash(const size_t hash) { return (uint8_t)(hash & 0x7f); }
+	static size_t groupFromHash(const size_t hash) { return hash >> 7; }
+
+	// Returns a bit mask with a set bit for each of the 16 control bytes (starting at @group) that are equal to @value.
+	static uint32_t matchGroup(const uint8_t* const group, const uint8_t value) {
+	#if BLOG_HAS_SSE2
+		const __m128i bytes = _mm_loadu_si128((const __m128i*)group);
+		return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8((char)value)));
+	#else
+		uint32_t mask = 0;
+		for(uint32_t t = 0; t < kGroupSize; ++t) {
+			if(group[t] == value) {
+				mask |= 1u << t;
+			}
+		}
+		return mask;
+	#endif
+	}
+
+	TableEntry* findEntry(const StringRef& key) const {
+		if(m_indexCapacity == 0) {
+			TableEntry* result = nullptr;
+			forEach([&](TableEntry& entry) {
+				if(result == nullptr && entry.key == key) {
+					result = &entry;
+				}
+			});
+			return result;
+		}
+
+		const size_t hash = key.hash();
+		const uint8_t control = controlFromHash(hash);
+		const size_t groupMask = m_indexCapacity / kGroupSize - 1;
+		size_t group = groupFromHash(hash) & groupMask;
+
+		// Triangular probing visits every group as the number of groups is a power of 2.
+		for(size_t probe = 1; ; ++probe) {
+			const uint8_t* const groupControl = m_indexControl + group * kGroupSize;
+
+			uint32_t matches = matchGroup(groupControl, control);
+			while(matches) {
+				TableEntry* const entry = m_indexSlots[group * kGroupSize + countTrailingZeros(matches)];
+				if(entry->key == key) {
+					return entry;
+				}
+				matches &= matches - 1;
+			}
+
+			if(matchGroup(groupControl, kControlEmpty)) {
+				return nullptr;
+			}
+
+			group = (group + probe) & groupMask;
+		}
+	}
+
+	void insertIntoIndex(TableEntry* const entry) {
+		const size_t hash = entry->key.hash();
+		const size_t groupMask = m_indexCapacity / kGroupSize - 1;
+		size_t group = groupFromHash(hash) & groupMask;
+
+		for(size_t probe = 1; ; ++probe) {
+			const uint32_t empty = matchGroup(m_indexControl + group * kGroupSize, kControlEmpty);
+			if(empty) {
+				const size_t slot = group * kGroupSize + countTrailingZeros(empty);
+				m_indexControl[slot] = controlFromHash(hash);
+				m_indexSlots[slot] = entry;
+				return;
+			}
+
+			group = (group + probe) & groupMask;
+		}
+	}
+
+	// Recreates the index with enough space for the current members (and some more).
+	void rebuildIndex() {
+		delete[] m_indexControl;
+		delete[] m_indexSlots;
+
+		m_indexCapacity = kGroupSize;
+		while(m_indexCapacity * 7 < m_size * 8 * 2) {
+			m_indexCapacity *= 2;
+		}
+
+		m_indexControl = new uint8_t[m_indexCapacity];
+		m_indexSlots = new TableEntry*[m_indexCapacity];
+		memset(m_indexControl, kControlEmpty, m_indexCapacity);
+
+		forEach([this](TableEntry& entry) { insertIntoIndex(&entry); });
+	}
+
+	// Returns the (uninitialized) memory for the next entry.
+	void* appendEntrySlot() {
+		if(m_size < m_inlineCapacity) {
+			return inlineEntries() + m_size;
+		}
+
+		size_t used = m_size - m_inlineCapacity;
+		for(const Chunk& chunk : m_chunks) {
+			if(used < chunk.capacity) {
+				return chunk.entries + used;
+			}
+			used -= chunk.capacity;
+		}
+
+		// Every chunk is full, allocate one as big as everything so far.
+		Chunk chunk;
+		chunk.capacity = std::max<uint32_t>(m_size, kMaxLinearSize);
+		chunk.entries = (TableEntry*)::operator new(chunk.capacity * sizeof(TableEntry));
+		m_chunks.push_back(chunk);
+		return chunk.entries;
+	}
+
+	uint32_t m_size = 0;
+	uint32_t m_inlineCapacity = 0; // The count of entries stored right after the table object.
+	std::vector<Chunk> m_chunks; // Storage for the entries that didn't fit inline.
+
+	// The index, used only when the table has more than kMaxLinearSize members.
+	size_t m_indexCapacity = 0; // Always a multiple of kGroupSize.
+	uint8_t* m_indexControl = nullptr; // kControlEmpty or the low 7 bits of the hash of the key in the slot.
+	TableEntry** m_indexSlots = nullptr;
+};
+
+// The storage of the elements of an array.
+// A buffer could be shared between an array and its slices, while shared it is never modified (see Array::makeUnique).
+// The reference count is not atomic, for the same reasons as StringBuffer.
+struct ArrayBuffer
+{
+	int refCount = 1;
+	uint32_t capacity = 0;
+
+	Var* elements() {
+		return (Var*)(this + 1);
+	}
+
+	// All @capacity elements are constructed (as undefined), the unused ones are kept undefined.
+	static ArrayBuffer* allocate(const uint32_t capacity) {
+		void* const memory = ::operator new(sizeof(ArrayBuffer) + capacity * sizeof(Var));
+		ArrayBuffer* const buffer = new(memory) ArrayBuffer();
+		buffer->capacity = capacity;
+		for(uint32_t t = 0; t < capacity; ++t) {
+			new(buffer->elements() + t) Var();
+		}
+		return buffer;
+	}
+
+	static void release(ArrayBuffer* const buffer) {
+		if(buffer && --buffer->refCount == 0) {
+			for(uint32_t t = 0; t < buffer->capacity; ++t) {
+				buffer->elements()[t].~Var();
+			}
+			buffer->~ArrayBuffer();
+			::operator delete(buffer);
+		}
+	}
+};
+
+// The arrays in our language.
+// The elements are the range [m_begin, m_end) of the buffer, there is free space kept on both sides,
+// so pushing and popping at both ends is O(1) (amortized for pushes).
+// A slice of an array shares the buffer with it until one of them is modified.
+struct Array : public GcObject
+{
+	Array()
+		: GcObject(gcObjectType_array)
+	{}
+
+	~Array() {
+		ArrayBuffer::release(m_buffer);
+	}
+
+	size_t size() const { return m_end - m_begin; }
+
+	const Var& at(const size_t idx) const {
+		return m_buffer->elements()[m_begin + idx];
+	}
+
+	// Returns a pointer to an element to be read. The buffer might be shared, so use elementForWrite to modify the element.
+	Var* elementForRead(const size_t idx) {
+		return m_buffer->elements() + m_begin + idx;
+	}
+
+	Var* elementForWrite(const size_t idx) {
+		makeUnique();
+		return m_buffer->elements() + m_begin + idx;
+	}
+
+	void reserve(const size_t capacity) {
+		if(m_buffer == nullptr || m_buffer->capacity < capacity) {
+			reallocate((uint32_t)capacity, 0);
+		}
+	}
+
+	// The value is copied first, it could be an element of this array, which making room moves or frees.
+	void pushBack(const Var& value) {
+		Var copy = value;
+		makeUnique();
+		if(m_buffer == nullptr || m_end == m_buffer->capacity) {
+			makeRoomAtBack();
+		}
+		m_buffer->elements()[m_end++] = std::move(copy);
+	}
+
+	void pushFront(const Var& value) {
+		Var copy = value;
+		makeUnique();
+		if(m_buffer == nullptr || m_begin == 0) {
+			makeRoomAtFront();
+		}
+		m_buffer->elements()[--m_begin] = std::move(copy);
+	}
+
+	// The array must not be empty.
+	Var popBack() {
+		assert(size() != 0);
+		makeUnique();
+		Var& element = m_buffer->elements()[--m_end];
+		Var result = std::move(element);
+		element = Var();
+		return result;
+	}
+
+	// The array must not be empty.
+	Var popFront() {
+		assert(size() != 0);
+		makeUnique();
+		Var& element = m_buffer->elements()[m_begin++];
+		Var result = std::move(element);
+		element = Var();
+		return result;
+	}
+
+	// Removes the element at @idx, shifting whichever side of the array is shorter.
+	Var erase(const size_t idx) {
+		assert(idx < size());
+		makeUnique();
+		Var* const elements = m_buffer->elements() + m_begin;
+		Var result = std::move(elements[idx]);
+
+		if(idx < size() / 2) {
+			std::move_backward(elements, elements + idx, elements + idx + 1);
+			elements[0] = Var();
+			m_begin++;
+		} else {
+			std::move(elements + idx + 1, elements + size(), elements + idx);
+			elements[size() - 1] = Var();
+			m_end--;
+		}
+
+		return result;
+	}
+
+	// Makes this array a view of the elements [from, to) of @source, without copying them.
+	void shareRange(Array& source, const size_t from, const size_t to) {
+		assert(from <= to && to <= source.size());
+		ArrayBuffer::release(m_buffer);
+		m_buffer = source.m_buffer;
+		m_begin = source.m_begin + (uint32_t)from;
+		m_end = source.m_begin + (uint32_t)to;
+		if(m_buffer) {
+			m_buffer->refCount++;
+		}
+	}
+
+	// Moves all elements of @source into this array, @source is left empty.
+	void moveElementsFrom(Array& source) {
+		source.makeUnique();
+		std::swap(m_buffer, source.m_buffer);
+		std::swap(m_begin, source.m_begin);
+		std::swap(m_end, source.m_end);
+		ArrayBuffer::release(source.m_buffer);
+		source.m_buffer = nullptr;
+		source.m_begin = source.m_end = 0;
+	}
+
+	// Calls @fn(Var&) for each element.
+	template<typename TFn>
+	void forEach(TFn&& fn) const {
+		for(uint32_t t = m_begin; t < m_end; ++t) {
+			fn(m_buffer->elements()[t]);
+		}
+	}
+
+	// The approximate memory used by the array, used by the garbage collector.
+	size_t memoryBytes() const {
+		return sizeof(Array) + (m_buffer ? sizeof(ArrayBuffer) + m_buffer->capacity * sizeof(Var) : 0);
+	}
+
+private :
+
+	static constexpr uint32_t kMinCapacity = 8;
+
+	// Gives this array its own copy of the buffer if it is shared with a slice (copy-on-write).
+	void makeUnique() {
+		if(m_buffer && m_buffer->refCount > 1) {
+			reallocate((uint32_t)size(), 0);
+		}
+	}
+
+	// Moves the elements to a new buffer with @capacity elements, where the 1st element is at @newBegin.
+	void reallocate(uint32_t capacity, const uint32_t newBegin) {
+		capacity = std::max(capacity, newBegin + (uint32_t)size());
+		capacity = std::max(capacity, kMinCapacity);
+
+		ArrayBuffer* const buffer = ArrayBuffer::allocate(capacity);
+		if(m_buffer) {
+			const bool isShared = m_buffer->refCount > 1;
+			for(uint32_t t = m_begin; t < m_end; ++t) {
+				if(isShared) buffer->elements()[newBegin + t - m_begin] = m_buffer->elements()[t];
+				else buffer->elements()[newBegin + t - m_begin] = std::move(m_buffer->elements()[t]);
+			}
+		}
+
+		const uint32_t count = (uint32_t)size();
+		ArrayBuffer::release(m_buffer);
+		m_buffer = buffer;
+		m_begin = newBegin;
+		m_end = newBegin + count;
+	}
+
+	void makeRoomAtBack() {
+		const uint32_t count = (uint32_t)size();
+		if(m_buffer && count * 2 <= m_buffer->capacity) {
+			// The array is used as a queue, slide the elements to the front instead of growing.
+			Var* const elements = m_buffer->elements();
+			std::move(elements + m_begin, elements + m_end, elements);
+			for(uint32_t t = count; t < m_end; ++t) elements[t] = Var();
+			m_begin = 0;
+			m_end = count;
+			return;
+		}
+
+		reallocate(count * 2, 0);
+	}
+
+	void makeRoomAtFront() {
+		const uint32_t count = (uint32_t)size();
+		if(m_buffer && count * 2 <= m_buffer->capacity) {
+			Var* const elements = m_buffer->elements();
+			const uint32_t newBegin = m_buffer->capacity - count;
+			std::move_backward(elements + m_begin, elements + m_end, elements + m_buffer->capacity);
+			for(uint32_t t = m_begin; t < newBegin; ++t) elements[t] = Var();
+			m_begin = newBegin;
+			m_end = m_buffer->capacity;
+			return;
+		}
+
+		const uint32_t capacity = std::max(count * 2, kMinCapacity);
+		reallocate(capacity, capacity - count);
+	}
+
+	ArrayBuffer* m_buffer = nullptr;
+	uint32_t m_begin = 0;
+	uint32_t m_end = 0;
+};
+
+// A single variable (or a temporary value) allocated by the Executor.
+// The Executor refers to the cells by their Var, that is why it must be the 1st member.
+struct VarCell
+{
+	Var var;
+	bool isMarked = false;
+
+	static VarCell* fromVar(Var* const var) {
+		return reinterpret_cast<VarCell*>(var);
+	}
+};
+
+static_assert(std::is_standard_layout<VarCell>::value, "VarCell must be convertible from its Var");
+
+// A graph of tables and arrays detached from one Heap, waiting to be adopted by another one (see Heap::detachGraph).
+// Nothing outside of the transfer references these objects, so it could be handed to another thread.
+struct HeapTransfer
+{
+	HeapTransfer() = default;
+	HeapTransfer(const HeapTransfer&) = delete;
+	HeapTransfer& operator=(const HeapTransfer&) = delete;
+
+	HeapTransfer(HeapTransfer&& other) noexcept
+		: root(std::move(other.root))
+		, objects(std::move(other.objects))
+	{
+		other.objects.clear();
+	}
+
+	HeapTransfer& operator=(HeapTransfer&& other) noexcept {
+		if(this != &other) {
+			freeObjects();
+			root = std::move(other.root);
+			objects = std::move(other.objects);
+			other.objects.clear();
+		}
+		return *this;
+	}
+
+	// A transfer that was never adopted still owns its objects.
+	~HeapTransfer() {
+		freeObjects();
+	}
+
+	Var root; // The value that was transfered.
+	std::vector<GcObject*> objects; // Every table and array reachable from the root.
+
+private :
+
+	void freeObjects() {
+		for(GcObject* const object : objects) {
+			delete object;
+		}
+		objects.clear();
+	}
+};
+
+enum GcPhase : int
+{
+	gcPhase_idle,
+	gcPhase_marking,
+	gcPhase_sweeping,
+};
+
+struct Heap
+{
+	Heap() = default;
+	Heap(const Heap&) = delete;
+	Heap& operator=(const Heap&) = delete;
+
+	~Heap() {
+		freeAll();
+	}
+
+	// Makes the calling thread the owner of the heap. See the transfer rules above.
+	void bindToCurrentThread() {
+		m_ownerThread = std::this_thread::get_id();
+	}
+
+	bool isOwnedByCurrentThread() const {
+		return m_ownerThread == std::this_thread::get_id();
+	}
+
+	VarCell* allocateCell() {
+		assert(isOwnedByCurrentThread());
+		VarCell* const cell = new VarCell();
+		cell->isMarked = (m_phase == gcPhase_marking); // Allocated black, so it survives the cycle that is in progress.
+		m_cells.push_back(cell);
+		noteAllocation(sizeof(VarCell));
+		return cell;
+	}
+
+	Table* allocateTable(const size_t expectedSize = 0) {
+		Table* const table = Table::create(expectedSize);
+		linkObject(table);
+		noteAllocation(table->memoryBytes());
+		return table;
+	}
+
+	Array* allocateArray() {
+		Array* const array = new Array();
+		linkObject(array);
+		noteAllocation(sizeof(Array));
+		return array;
+	}
+
+	// Used to account for the memory that tables and arrays allocate when they grow, and for new strings.
+	// Fails the script once the heap is over its hard limit, so a single statement (like a native building a huge result) can't
+	// allocate without bound until the next safe point. Nothing could be collected here, as the values being built aren't rooted,
+	// so the garbage left since the last safe point counts too. That is what the room between the soft and the hard limit is for.
+	// Natives that know the size of their result should account for it before allocating it.
+	void noteAllocation(const size_t bytes) {
+		m_bytesAllocatedSinceCycle += bytes;
+		m_usedBytes += bytes;
+		if(m_usedBytes > hardLimitBytes) {
+			ThrowError(statementLocation, "The script exceeded its memory limit");
+		}
+	}
+
+	// The memory held by a string value. Strings are shared, so the same buffer could be accounted more than once,
+	// the constants of the program aren't accounted at all.
+	static size_t stringBytes(const Var& var) {
+		if(var.m_varType != varType_string || var.m_value_string.buffer() == nullptr || var.m_value_string.buffer()->isImmortal) {
+			return 0;
+		}
+		return var.m_value_string.size();
+	}
+
+	// The estimated bytes used by the values, tables, arrays and strings that weren't collected yet.
+	// Between collections this only grows, the memory freed by a cycle is accounted once the cycle is done.
+	size_t usedBytes() const {
+		return m_usedBytes;
+	}
+
+	// The highest usedBytes seen.
+	size_t peakBytes() const {
+		return std::max(m_peakBytes, m_usedBytes);
+	}
+
+	// Starts tracking the peak from the current usage, for example when the heap is reused for another script.
+	void resetPeak() {
+		m_peakBytes = m_usedBytes;
+	}
+
+	bool isOverHardLimit() const {
+		return m_usedBytes > hardLimitBytes;
+	}
+
+	bool isCollecting() const {
+		return m_phase != gcPhase_idle;
+	}
+
+	bool shouldStartCycle() const {
+		// Above the soft limit, collect more often than the usual pace, but not on every allocation, as the limit might be below the live memory.
+		if(m_usedBytes >= softLimitBytes && m_bytesAllocatedSinceCycle >= softLimitBytes / 8) {
+			return true;
+		}
+
+		return m_bytesAllocatedSinceCycle >= std::max(minCycleTriggerBytes, m_liveBytes);
+	}
+
+	// Moves the tables and arrays reachable from @root out of this heap. The source objects are left empty,
+	// so anything in this heap that still references them sees empty tables and arrays.
+	// The moved values are still referenced by the script until then, so they are not copied, only the references between them are updated.
+	HeapTransfer detachGraph(const Var& root) {
+		assert(isOwnedByCurrentThread());
+
+		HeapTransfer transfer;
+		std::unordered_map<GcObject*, GcObject*> detachedObjects; // The source object -> the object in the transfer that took its contents.
+		std::vector<Var*> pending; // Values in the transfer that may still reference objects or strings of this heap.
+
+		transfer.root = root;
+		pending.push_back(&transfer.root);
+		while(pending.empty() == false) {
+			Var* const var = pending.back();
+			pending.pop_back();
+
+			if(var->m_varType == varType_string) {
+				makeStringExclusive(var->m_value_string);
+			}
+			else if(var->m_varType == varType_table && var->m_table) {
+				GcObject*& detached = detachedObjects[var->m_table];
+				if(detached == nullptr) {
+					Table* const table = Table::create(var->m_table->size());
+					var->m_table->forEach([this](const TableEntry& entry) { writeBarrier(entry.value); });
+					table->moveEntriesFrom(*var->m_table);
+					transfer.objects.push_back(table);
+					detached = table;
+
+					table->forEach([&](TableEntry& entry) {
+						makeStringExclusive(entry.key);
+						pending.push_back(&entry.value);
+					});
+				}
+				var->m_table = static_cast<Table*>(detached);
+			}
+			else if(var->m_varType == varType_array && var->m_array) {
+				GcObject*& detached = detachedObjects[var->m_array];
+				if(detached == nullptr) {
+					Array* const array = new Array();
+					var->m_array->forEach([this](const Var& value) { writeBarrier(value); });
+					array->moveElementsFrom(*var->m_array);
+					transfer.objects.push_back(array);
+					detached = array;
+
+					array->forEach([&pending](Var& value) { pending.push_back(&value); });
+				}
+				var->m_array = static_cast<Array*>(detached);
+			}
+		}
+
+		return transfer;
+	}
+
+	// Takes the ownership of the objects in the transfer and returns the transfered value.
+	Var adoptGraph(HeapTransfer&& transfer) {
+		assert(isOwnedByCurrentThread());
+
+		// Every object is linked before accounting for them, as going over the limit throws.
+		size_t bytes = 0;
+		for(GcObject* const object : transfer.objects) {
+			linkObject(object);
+			bytes += estimateSize(object);
+		}
+		transfer.objects.clear();
+
+		Var root = std::move(transfer.root);
+		noteAllocation(bytes);
+		return root;
+	}
+
+	// Starts a new collection cycle. The caller should mark all the roots right after that (see markCell).
+	void beginCycle() {
+		assert(isOwnedByCurrentThread());
+		assert(m_phase == gcPhase_idle);
+		m_phase = gcPhase_marking;
+		m_bytesAllocatedSinceCycle = 0;
+		m_markedStringBytes = 0;
+	}
+
+	void markCell(VarCell* const cell) {
+		if(cell->isMarked == false) {
+			cell->isMarked = true;
+			shade(cell->var);
+		}
+	}
+
+	// Should be called with the old value before overwriting any value that is reachable by the script.
+	void writeBarrier(const Var& oldValue) {
+		if(m_phase == gcPhase_marking) {
+			shade(oldValue);
+		}
+	}
+
+	// Performs a bounded amount of work for the current cycle.
+	void step() {
+		// If the script allocates faster than we collect, stop being incremental, otherwise the heap would grow without bound.
+		// Same if it is already above the soft limit, so the memory gets back as soon as possible.
+		if(m_bytesAllocatedSinceCycle >= 2 * std::max(minCycleTriggerBytes, m_liveBytes) || m_usedBytes >= softLimitBytes) {
+			finishCycle();
+			return;
+		}
+
+		performWork(stepBudget);
+	}
+
+	void finishCycle() {
+		while(m_phase != gcPhase_idle) {
+			performWork(SIZE_MAX);
+		}
+	}
+
+	// Tuning parameters. A cycle starts when the bytes allocated since the last one reach the bytes
+	// that survived it (but no less than minCycleTriggerBytes). stepBudget is the amount of objects
+	// and values that are visited in a single step.
+	size_t minCycleTriggerBytes = 4 * 1024 * 1024;
+	size_t stepBudget = 4096;
+
+	// Memory limits of the script (see usedBytes). Above the soft limit collections are started more eagerly,
+	// above the hard limit the Executor fails the script, if a full collection doesn't bring it back under the limit.
+	size_t softLimitBytes = SIZE_MAX;
+	size_t hardLimitBytes = SIZE_MAX;
+
+	// The statement that is running, where going over the hard limit is reported (set by Executor::gcSafePoint).
+	Location statementLocation;
+
+private :
+
+	// Gives @s its own buffer, unless it is the only reference to it already.
+	static void makeStringExclusive(StringRef& s) {
+		s.c_str(); // Flatten ropes and copy slices, after that they don't reference other buffers.
+
+		const StringBuffer* const buffer = s.buffer();
+		if(buffer && (buffer->isImmortal || buffer->refCount != 1)) {
+			s = StringRef::fromChars(s.c_str(), s.size());
+		}
+	}
+
+	void linkObject(GcObject* const object) {
+		assert(isOwnedByCurrentThread());
+		object->gcIsMarked = (m_phase == gcPhase_marking);
+		object->gcNext = m_objects;
+		m_objects = object;
+	}
+
+	void shade(const Var& var) {
+		GcObject* object = nullptr;
+		if(var.m_varType == varType_table) object = var.m_table;
+		else if(var.m_varType == varType_array) object = var.m_array;
+
+		if(object && object->gcIsMarked == false) {
+			object->gcIsMarked = true;
+			m_grayObjects.push_back(object);
+		}
+	}
+
+	static size_t estimateSize(const GcObject* const object) {
+		if(object->gcType == gcObjectType_table) {
+			return static_cast<const Table*>(object)->memoryBytes();
+		} else {
+			return static_cast<const Array*>(object)->memoryBytes();
+		}
+	}
+
+	void performWork(size_t budget) {
+		while(budget > 0 && m_phase == gcPhase_marking) {
+			if(m_grayObjects.empty()) {
+				// Everything reachable is marked, move the current objects aside and sweep them.
+				// Objects allocated during the sweep go to the (now empty) lists and are not visited by this sweep.
+				m_phase = gcPhase_sweeping;
+				m_sweepObjects = m_objects;
+				m_objects = nullptr;
+				m_sweepCells.swap(m_cells);
+				m_sweepCellIdx = 0;
+				m_liveBytes = m_markedStringBytes;
+				m_usedBytesAtSweepStart = m_usedBytes;
+				break;
+			}
+
+			GcObject* const object = m_grayObjects.back();
+			m_grayObjects.pop_back();
+
+			if(object->gcType == gcObjectType_table) {
+				const Table* const table = static_cast<const Table*>(object);
+				table->forEach([this](const TableEntry& entry) {
+					shade(entry.value);
+					m_markedStringBytes += stringBytes(entry.value);
+				});
+				budget -= std::min(budget, table->size() + 1);
+			} else {
+				const Array* const array = static_cast<const Array*>(object);
+				array->forEach([this](const Var& var) {
+					shade(var);
+					m_markedStringBytes += stringBytes(var);
+				});
+				budget -= std::min(budget, array->size() + 1);
+			}
+		}
+
+		while(budget > 0 && m_phase == gcPhase_sweeping) {
+			if(m_sweepCellIdx < m_sweepCells.size()) {
+				VarCell* const cell = m_sweepCells[m_sweepCellIdx++];
+				if(cell->isMarked) {
+					cell->isMarked = false;
+					m_cells.push_back(cell);
+					m_liveBytes += sizeof(VarCell) + stringBytes(cell->var);
+				} else {
+					delete cell;
+				}
+			}
+			else if(m_sweepObjects != nullptr) {
+				GcObject* const object = m_sweepObjects;
+				m_sweepObjects = object->gcNext;
+				if(object->gcIsMarked) {
+					object->gcIsMarked = false;
+					object->gcNext = m_objects;
+					m_objects = object;
+					m_liveBytes += estimateSize(object);
+				} else {
+					delete object;
+				}
+			}
+			else {
+				m_sweepCells.clear();
+				m_phase = gcPhase_idle;
+				// The survivors and what got allocated meanwhile. usedBytes only grows until here, so this is where the peak could be.
+				m_peakBytes = std::max(m_peakBytes, m_usedBytes);
+				m_usedBytes = m_liveBytes + (m_usedBytes - m_usedBytesAtSweepStart);
+				break;
+			}
+
+			budget--;
+		}
+	}
+
+	void freeAll() {
+		for(VarCell* cell : m_cells) delete cell;
+		for(size_t t = m_sweepCellIdx; t < m_sweepCells.size(); ++t) delete m_sweepCells[t];
+
+		for(GcObject* list : { m_objects, m_sweepObjects }) {
+			while(list) {
+				GcObject* const next = list->gcNext;
+				delete list;
+				list = next;
+			}
+		}
+
+		m_cells.clear();
+		m_sweepCells.clear();
+		m_objects = nullptr;
+		m_sweepObjects = nullptr;
+		m_grayObjects.clear();
+		m_phase = gcPhase_idle;
+	}
+
+	std::thread::id m_ownerThread = std::this_thread::get_id();
+	GcPhase m_phase = gcPhase_idle;
+	std::vector<VarCell*> m_cells; // All cells owned by the heap (except the ones waiting to be swept).
+	GcObject* m_objects = nullptr; // All tables and arrays owned by the heap (except the ones waiting to be swept).
+	std::vector<GcObject*> m_grayObjects; // Marked objects whose references are not yet marked.
+	std::vector<VarCell*> m_sweepCells; // Cells waiting to be swept.
+	size_t m_sweepCellIdx = 0;
+	GcObject* m_sweepObjects = nullptr; // Objects waiting to be swept.
+	size_t m_bytesAllocatedSinceCycle = 0;
+	size_t m_liveBytes = 0; // Estimated bytes that survived the last cycle.
+	size_t m_usedBytesAtSweepStart = 0;
+	size_t m_markedStringBytes = 0; // The strings in the tables and arrays marked by the current cycle.
+	size_t m_usedBytes = 0;
+	size_t m_peakBytes = 0;
+};
+
+// Converts a number to the shortest string that reads back to the same number (used when concatenating strings).
+StringRef numberToString(const float value)
+{
+	char buffer[32];
+	const std::to_chars_result result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+	return StringRef::fromChars(buffer, result.ptr - buffer);
+}
+
+StringRef numberToString(const int64_t value)
+{
+	char buffer[32];
+	const std::to_chars_result result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+	return StringRef::fromChars(buffer, result.ptr - buffer);
+}
+
+// A callback used by the host to receive the output of the script (see OutputSink).
+typedef void (*OutputWriteFn)(const char* data, size_t size, void* userData);
+
+// The destination of everything printed by the script.
+// The output is gathered in a buffer and handed to the host (or stdout by default) in large writes,
+// instead of calling into stdio for every printed value.
+struct OutputSink
+{
+	OutputSink() = default;
+	OutputSink(const OutputSink&) = delete;
+	OutputSink& operator=(const OutputSink&) = delete;
+
+	~OutputSink() {
+		flush();
+	}
+
+	// Redirects the output to the specified callback. Passing nullptr restores the default stdout output.
+	void redirect(OutputWriteFn const writeFn, void* const userData) {
+		flush();
+		m_writeFn = writeFn;
+		m_userData = userData;
+	}
+
+	void write(const char* const data, const size_t size) {
+		if(m_used + size > kBufferSize) {
+			flush();
+
+			// Too big to be buffered, just pass it through.
+			if(size > kBufferSize) {
+				writeToHost(data, size);
+				return;
+			}
+		}
+
+		memcpy(m_buffer + m_used, data, size);
+		m_used += size;
+	}
+
+	void write(const char* const str) {
+		write(str, strlen(str));
+	}
+
+	void flush() {
+		if(m_used != 0) {
+			writeToHost(m_buffer, m_used);
+			m_used = 0;
+		}
+	}
+
+private :
+
+	void writeToHost(const char* const data, const size_t size) {
+		if(m_writeFn) {
+			m_writeFn(data, size, m_userData);
+		} else {
+			fwrite(data, 1, size, stdout);
+		}
+	}
+
+	static const size_t kBufferSize = 64 * 1024;
+
+	OutputWriteFn m_writeFn = nullptr;
+	void* m_userData = nullptr;
+	size_t m_used = 0;
+	char m_buffer[kBufferSize];
+};
+
+// Just a function that prints the type and value of the specified variable to the specified output.
+void printVariable(OutputSink& out, const Var* const expr)
+{
+	if(expr->m_varType == varType_f32) {
+		char buffer[64];
+		const std::to_chars_result result = std::to_chars(buffer, buffer + sizeof(buffer) - 1, (double)expr->m_value_f32, std::chars_format::fixed, 6);
+		*result.ptr = '\n';
+		out.write(buffer, result.ptr - buffer + 1);
+	}
+	else if(expr->m_varType == varType_i64) {
+		char buffer[32];
+		const std::to_chars_result result = std::to_chars(buffer, buffer + sizeof(buffer) - 1, expr->m_value_i64);
+		*result.ptr = '\n';
+		out.write(buffer, result.ptr - buffer + 1);
+	}
+	else if(expr->m_varType == varType_string) {
+		out.write(expr->m_value_string.data(), expr->m_value_string.size());
+		out.write("\n", 1);
+	}
+	else if(expr->m_varType == varType_fn) {
+		char buffer[64];
+		snprintf(buffer, sizeof(buffer), "<function %i>\n", expr->m_fnDecl->fnIdx);
+		out.write(buffer);
+	}
+	else if(expr->m_varType == varType_table)
+	{
+		out.write("{ \n");
+		if(expr->m_table)
+		expr->m_table->forEach([&out](const TableEntry& entry)
+		{
+			out.write(entry.key.data(), entry.key.size());
+			out.write(" = ");
+			printVariable(out, &entry.value);
+		});
+		out.write(" }\n");
+	}
+	else if(expr->m_varType == varType_array)
+	{
+		out.write("[ \n");
+		if(expr->m_array)
+			expr->m_array->forEach([&out](const Var& var)
+			{
+				printVariable(out, &var);
+			});
+		out.write(" ]\n");
+	}
+	else
+		out.write("<undefined>\n");
+};
+
+// Represents a 'scope' in our language. Each function or a block create it's own scope
+// in order to enable us to have colliding variable names.
+// Even if the variables are in different functions we still need this scope.
+// In our case, depending on the current block, we just amend all scopes (the currenct scope is stored in an array).,
+// at the begining of the variable name - this is name collisions are resolved.
+struct Scope
+{
+	std::string scope;
+};
+
+// Compares two values for equality the same way the == operator does, tables, arrays and functions are compared by identity.
+inline bool areValuesEqual(const Var& a, const Var& b)
+{
+	if(a.isNumber() && b.isNumber() && a.m_varType != b.m_varType) {
+		return a.asFloat32() == b.asFloat32();
+	}
+
+	if(a.m_varType != b.m_varType) {
+		return false;
+	}
+
+	switch(a.m_varType) {
+		case varType_undefined: return true;
+		case varType_table: return a.m_table == b.m_table;
+		case varType_array: return a.m_array == b.m_array;
+		case varType_f32: return a.m_value_f32 == b.m_value_f32;
+		case varType_i64: return a.m_value_i64 == b.m_value_i64;
+		case varType_string: return a.m_value_string == b.m_value_string;
+		case varType_fn: return a.m_fnDecl == b.m_fnDecl;
+		case varType_fnNative: return a.m_fnNative == b.m_fnNative;
+	}
+
+	return false;
+}
+
+// Reads an index or a count passed to a native function. Integers are exact, floats are truncated.
+inline bool getIntegerArgument(const Var* const var, int64_t& out)
+{
+	if(var == nullptr) {
+		return false;
+	}
+
+	if(var->m_varType == varType_i64) {
+		out = var->m_value_i64;
+		return true;
+	}
+
+	if(var->m_varType == varType_f32) {
+		out = (int64_t)var->m_value_f32;
+		return true;
+	}
+
+	return false;
+}
+
+// Integer arithmetic that reports overflow (by returning false) instead of wrapping around.
+inline bool checkedAdd(const int64_t a, const int64_t b, int64_t& out)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	return !__builtin_add_overflow(a, b, &out);
+#else
+	if((b > 0 && a > INT64_MAX - b) || (b < 0 && a < INT64_MIN - b)) return false;
+	out = a + b;
+	return true;
+#endif
+}
+
+inline bool checkedSub(const int64_t a, const int64_t b, int64_t& out)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	return !__builtin_sub_overflow(a, b, &out);
+#else
+	if((b < 0 && a > INT64_MAX + b) || (b > 0 && a < INT64_MIN + b)) return false;
+	out = a - b;
+	return true;
+#endif
+}
+
+inline bool checkedMul(const int64_t a, const int64_t b, int64_t& out)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	return !__builtin_mul_overflow(a, b, &out);
+#else
+	if(a != 0 && b != 0) {
+		if(a == -1 && b == INT64_MIN) return false;
+		if(b == -1 && a == INT64_MIN) return false;
+		const int64_t r = a * b;
+		if(r / b != a) return false;
+	}
+	out = a * b;
+	return true;
+#endif
+}
+
+// The ordering of numbers used by sorting. NaNs go last, so the ordering stays strict weak.
+inline bool isFloatLess(const float a, const float b)
+{
+	return a < b || (b != b && a == a);
+}
+
+// Sorts the numbers by sorting @numChunks parts of them on their own threads and then merging the sorted parts pairwise (also in parallel).
+template<typename T, typename TLess>
+void parallelSort(T* const data, const size_t count, const size_t numChunks, TLess isLess)
+{
+	std::vector<size_t> bounds(numChunks + 1);
+	for(size_t t = 0; t <= numChunks; ++t) {
+		bounds[t] = count * t / numChunks;
+	}
+
+	std::vector<std::thread> threads;
+	for(size_t t = 0; t < numChunks; ++t) {
+		threads.emplace_back([=, &bounds]() { std::sort(data + bounds[t], data + bounds[t + 1], isLess); });
+	}
+	for(std::thread& thread : threads) thread.join();
+
+	for(size_t width = 1; width < numChunks; width *= 2) {
+		threads.clear();
+		for(size_t t = 0; t + width < numChunks; t += 2 * width) {
+			const size_t mergeEnd = std::min(t + 2 * width, numChunks);
+			threads.emplace_back([=, &bounds]() {
+				std::inplace_merge(data + bounds[t], data + bounds[t + width], data + bounds[mergeEnd], isLess);
+			});
+		}
+		for(std::thread& thread : threads) thread.join();
+	}
+}
+
+//-----------------------------------------------------------------------------------------------------
+// Value files.
+// Data could be loaded from JSON files, or saved to and loaded from files in a compact binary format (the one of the heap snapshots,
+// see HeapSnapshot). Both are read straight from the mapped file into tables and arrays, without going through the Lexer and the Parser.
+//-----------------------------------------------------------------------------------------------------
+
+// A read-only view of the contents of a file. The file is mapped in memory where possible, so only the pages that are used are read.
+struct MappedFile
+{
+	MappedFile() = default;
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	~MappedFile() {
+		close();
+	}
+
+	bool open(const char* const path) {
+		close();
+#if defined(_WIN32)
+		FILE* const f = fopen(path, "rb");
+		if(f == nullptr) {
+			return false;
+		}
+		fseek(f, 0, SEEK_END);
+		m_contents.resize(ftell(f));
+		fseek(f, 0, SEEK_SET);
+		const bool isRead = fread(m_contents.data(), 1, m_contents.size(), f) == m_contents.size();
+		fclose(f);
+
+		m_data = m_contents.data();
+		m_size = m_contents.size();
+		return isRead;
+#else
+		const int fd = ::open(path, O_RDONLY);
+		if(fd < 0) {
+			return false;
+		}
+
+		struct stat fileStat;
+		bool isMapped = fstat(fd, &fileStat) == 0;
+		if(isMapped && fileStat.st_size > 0) {
+			void* const mapping = mmap(nullptr, (size_t)fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			isMapped = mapping != MAP_FAILED;
+			if(isMapped) {
+				m_data = (const char*)mapping;
+				m_size = (size_t)fileStat.st_size;
+			}
+		}
+		::close(fd);
+		return isMapped;
+#endif
+	}
+
+	void close() {
+#if defined(_WIN32)
+		m_contents.clear();
+#else
+		if(m_data) {
+			munmap((void*)m_data, m_size);
+		}
+#endif
+		m_data = nullptr;
+		m_size = 0;
+	}
+
+	const char* data() const { return m_data; }
+	size_t size() const { return m_size; }
+
+private :
+	const char* m_data = nullptr;
+	size_t m_size = 0;
+#if defined(_WIN32)
+	std::vector<char> m_contents;
+#endif
+};
+
+// A native function registered with Executor::newVariableNativeFunction, value files refer to them by name.
+struct NativeFunction
+{
+	std::string name;
+	NativeFnPtr fnPtr;
+	Var* var; // The global variable that holds it, kept by Executor::reset.
+	int symbol;
+};
+
+// The start of a value file. It is followed by the type and size of each table and array, then their contents and finally the roots:
+// the values that were saved, each with a name (the global variables of a snapshot). Values refer to tables and arrays by their index,
+// so objects that are shared (or referenced in a cycle) are read once.
+// Everything is stored in the byte order of the machine, the files are meant to be read by the runtime that wrote them.
+struct ValueFileHeader
+{
+	static constexpr char kMagic[8] = {'B', 'L', 'O', 'G', 'V', 'A', 'L', 'S'};
+	static constexpr uint32_t kVersion = 1;
+
+	char magic[8];
+	uint32_t version;
+	uint32_t objectCount;
+	uint64_t sourceHash; // Script functions are stored by their index in Parser::m_functions, so they are only valid for the same script.
+	uint32_t rootCount;
+	uint32_t reserved;
+};
+
+// Writes a value file. Native functions are written by name, script functions only if the hash of the script is given.
+struct ValueWriter
+{
+	explicit ValueWriter(const std::vector<NativeFunction>& natives)
+		: m_natives(natives)
+	{}
+
+	void addRoot(const std::string_view name, const Var& value) {
+		m_roots.emplace_back(std::string(name), value);
+	}
+
+	// @sourceHash identifies the script that the functions in the values belong to, 0 if functions can't be written.
+	bool write(const uint64_t sourceHash, const char* const path, std::string& error) {
+		m_sourceHash = sourceHash;
+
+		// Number every table and array reachable from the roots, in the order that they are found.
+		for(const auto& root : m_roots) {
+			numberObjects(root.second);
+		}
+		for(size_t t = 0; t < m_objects.size(); ++t) {
+			if(m_objects[t]->gcType == gcObjectType_table) {
+				static_cast<const Table*>(m_objects[t])->forEach([this](const TableEntry& entry) { numberObjects(entry.value); });
+			} else {
+				static_cast<const Array*>(m_objects[t])->forEach([this](const Var& value) { numberObjects(value); });
+			}
+		}
+
+		ValueFileHeader header = {};
+		memcpy(header.magic, ValueFileHeader::kMagic, sizeof(header.magic));
+		header.version = ValueFileHeader::kVersion;
+		header.objectCount = (uint32_t)m_objects.size();
+		header.sourceHash = sourceHash;
+		header.rootCount = (uint32_t)m_roots.size();
+		save(header);
+
+		for(const GcObject* const object : m_objects) {
+			const bool isTable = object->gcType == gcObjectType_table;
+			save((uint8_t)object->gcType);
+			save((uint32_t)(isTable ? static_cast<const Table*>(object)->size() : static_cast<const Array*>(object)->size()));
+		}
+
+		for(const GcObject* const object : m_objects) {
+			if(object->gcType == gcObjectType_table) {
+				static_cast<const Table*>(object)->forEach([this](const TableEntry& entry) {
+					saveString(entry.key.view());
+					saveValue(entry.value);
+				});
+			} else {
+				static_cast<const Array*>(object)->forEach([this](const Var& value) { saveValue(value); });
+			}
+		}
+
+		for(const auto& root : m_roots) {
+			saveString(root.first);
+			saveValue(root.second);
+		}
+
+		if(m_error.empty() == false) {
+			error = m_error;
+			return false;
+		}
+
+		FILE* const f = fopen(path, "wb");
+		if(f == nullptr) {
+			error = "could not open the file";
+			return false;
+		}
+		const bool isWritten = fwrite(m_out.data(), 1, m_out.size(), f) == m_out.size();
+		fclose(f);
+		if(!isWritten) {
+			error = "could not write the file";
+			return false;
+		}
+
+		return true;
+	}
+
+private :
+
+	void numberObjects(const Var& value) {
+		const GcObject* object = nullptr;
+		if(value.m_varType == varType_table) {
+			object = value.m_table;
+		} else if(value.m_varType == varType_array) {
+			object = value.m_array;
+		}
+
+		if(object && m_objectIndices.emplace(object, (uint32_t)m_objects.size()).second) {
+			m_objects.push_back(object);
+		}
+	}
+
+	template<typename T>
+	void save(const T& value) {
+		m_out.append((const char*)&value, sizeof(T));
+	}
+
+	void saveString(const std::string_view s) {
+		save((uint32_t)s.size());
+		m_out.append(s.data(), s.size());
+	}
+
+	void saveValue(const Var& value) {
+		// Tables and arrays that were never created are stored as undefined, like they read.
+		VarType type = value.m_varType;
+		if((type == varType_table && value.m_table == nullptr) || (type == varType_array && value.m_array == nullptr)) {
+			type = varType_undefined;
+		}
+
+		save((uint8_t)type);
+		switch(type) {
+			case varType_undefined: break;
+			case varType_f32: save(value.m_value_f32); break;
+			case varType_i64: save(value.m_value_i64); break;
+			case varType_string: saveString(value.m_value_string.view()); break;
+			case varType_fn:
+			{
+				if(m_sourceHash == 0) {
+					m_error = "script functions could only be saved in snapshots";
+				}
+				save((uint32_t)value.m_fnDecl->fnIdx);
+			}break;
+			case varType_fnNative:
+			{
+				const auto itr = std::find_if(m_natives.begin(), m_natives.end(), [&value](const NativeFunction& n) { return n.fnPtr == value.m_fnNative; });
+				if(itr == m_natives.end()) {
+					m_error = "a value is a native function that wasn't registered with the Executor";
+				}
+				saveString(itr != m_natives.end() ? std::string_view(itr->name) : std::string_view());
+			}break;
+			case varType_table: save(m_objectIndices.at(value.m_table)); break;
+			case varType_array: save(m_objectIndices.at(value.m_array)); break;
+		}
+	}
+
+	const std::vector<NativeFunction>& m_natives;
+	std::vector<std::pair<std::string, Var>> m_roots;
+	uint64_t m_sourceHash = 0;
+	std::string m_out;
+	std::string m_error;
+	std::unordered_map<const GcObject*, uint32_t> m_objectIndices;
+	std::vector<const GcObject*> m_objects; // Indexed by the object indices used in the file.
+};
+
+// Reads a value file into a heap, in a single pass over the (mapped) file. Tables are created with their final size and arrays are reserved.
+// Nothing is collected while reading, as there is no safe point, so the values don't need to be rooted until the reading is done.
+struct ValueReader
+{
+	// Script functions are read only if @parser is given, it must have parsed the script that wrote the file.
+	// Member names that are constants of that script reuse the constant, so they compare by address with the member names in the code.
+	ValueReader(Heap& heap, const Parser* const parser, const std::vector<NativeFunction>& natives)
+		: m_heap(heap)
+		, m_parser(parser)
+		, m_natives(natives)
+	{}
+
+	// @sourceHash is the hash of the script parsed by the parser, if any (see ValueFileHeader::sourceHash).
+	bool read(const char* const data, const size_t size, const uint64_t sourceHash, std::string& error) {
+		m_in = data;
+		m_inEnd = data + size;
+
+		ValueFileHeader header;
+		if(!load(header) || memcmp(header.magic, ValueFileHeader::kMagic, sizeof(header.magic)) != 0 || header.version != ValueFileHeader::kVersion) {
+			error = "not a value file";
+			return false;
+		}
+
+		if(m_parser && header.sourceHash != sourceHash) {
+			error = "the file was written for a different script";
+			return false;
+		}
+		if(m_parser == nullptr && header.sourceHash != 0) {
+			error = "the file is a snapshot, only its script could restore it";
+			return false;
+		}
+
+		// Create every object first, as values could refer to the ones that come after them.
+		std::vector<uint32_t> objectSizes;
+		for(uint32_t t = 0; t < header.objectCount && m_error.empty(); ++t) {
+			uint8_t type = 0;
+			uint32_t size = 0;
+			// Each member takes at least a byte, anything bigger than the rest of the file is corrupted.
+			if(!load(type) || !load(size) || size > (size_t)(m_inEnd - m_in)) {
+				m_error = "the file is corrupted";
+			}
+			else if(type == gcObjectType_table) {
+				m_objects.push_back(m_heap.allocateTable(size));
+			}
+			else if(type == gcObjectType_array) {
+				Array* const array = m_heap.allocateArray();
+				m_objects.push_back(array);
+				m_heap.noteAllocation(size * sizeof(Var));
+				array->reserve(size);
+			}
+			else {
+				m_error = "the file is corrupted";
+			}
+			objectSizes.push_back(size);
+		}
+
+		for(size_t iObject = 0; iObject < m_objects.size() && m_error.empty(); ++iObject) {
+			if(m_objects[iObject]->gcType == gcObjectType_table) {
+				Table* const table = static_cast<Table*>(m_objects[iObject]);
+				for(uint32_t t = 0; t < objectSizes[iObject] && m_error.empty(); ++t) {
+					StringRef key;
+					Var value;
+					if(loadMemberName(key) && loadValue(value)) {
+						*table->findOrInsert(key) = std::move(value);
+					}
+				}
+			} else {
+				Array* const array = static_cast<Array*>(m_objects[iObject]);
+				for(uint32_t t = 0; t < objectSizes[iObject] && m_error.empty(); ++t) {
+					Var value;
+					if(loadValue(value)) {
+						array->pushBack(value);
+					}
+				}
+			}
+		}
+
+		for(uint32_t t = 0; t < header.rootCount && m_error.empty(); ++t) {
+			StringRef name;
+			Var value;
+			if(loadString(name) && loadValue(value)) {
+				roots.emplace_back(std::move(name), std::move(value));
+			}
+		}
+
+		if(m_error.empty() && m_in != m_inEnd) {
+			m_error = "the file is corrupted";
+		}
+
+		if(m_error.empty() == false) {
+			error = m_error;
+			roots.clear();
+			return false;
+		}
+		return true;
+	}
+
+	std::vector<std::pair<StringRef, Var>> roots; // The named values that were saved, in the order that they were saved.
+
+private :
+
+	template<typename T>
+	bool load(T& value) {
+		if(m_inEnd - m_in < (ptrdiff_t)sizeof(T)) {
+			m_error = "the file is corrupted";
+			return false;
+		}
+		memcpy(&value, m_in, sizeof(T));
+		m_in += sizeof(T);
+		return true;
+	}
+
+	bool loadChars(std::string_view& s) {
+		uint32_t size = 0;
+		if(!load(size)) {
+			return false;
+		}
+		if((size_t)(m_inEnd - m_in) < size) {
+			m_error = "the file is corrupted";
+			return false;
+		}
+		s = std::string_view(m_in, size);
+		m_in += size;
+		return true;
+	}
+
+	// Copies a string out of the file.
+	bool loadString(StringRef& s) {
+		std::string_view chars;
+		if(!loadChars(chars)) {
+			return false;
+		}
+
+		s = StringRef::fromChars(chars.data(), chars.size());
+		m_heap.noteAllocation(chars.size());
+		return true;
+	}
+
+	// Member names repeat a lot (think of an array of records), so the equal ones share a buffer.
+	bool loadMemberName(StringRef& s) {
+		std::string_view chars;
+		if(!loadChars(chars)) {
+			return false;
+		}
+
+		StringRef& name = m_memberNames[chars];
+		if(name.buffer() == nullptr && m_parser) {
+			const auto itr = m_parser->m_stringConstants.find(std::string(chars));
+			if(itr != m_parser->m_stringConstants.end()) {
+				name = StringRef(itr->second);
+			}
+		}
+		if(name.buffer() == nullptr) {
+			name = StringRef::fromChars(chars.data(), chars.size());
+			m_heap.noteAllocation(chars.size());
+		}
+
+		s = name;
+		return true;
+	}
+
+	bool loadValue(Var& value) {
+		uint8_t type = 0;
+		if(!load(type)) {
+			return false;
+		}
+
+		switch(type) {
+			case varType_undefined:
+			{
+				value = Var();
+				return true;
+			}
+			case varType_f32:
+			{
+				float f32 = 0.f;
+				if(!load(f32)) return false;
+				value.makeFloat32(f32);
+				return true;
+			}
+			case varType_i64:
+			{
+				int64_t i64 = 0;
+				if(!load(i64)) return false;
+				value.makeInt64(i64);
+				return true;
+			}
+			case varType_string:
+			{
+				StringRef s;
+				if(!loadString(s)) return false;
+				value.makeString(std::move(s));
+				return true;
+			}
+			case varType_fn:
+			{
+				uint32_t fnIdx = 0;
+				if(!load(fnIdx)) return false;
+				if(m_parser == nullptr) break;
+				if(fnIdx >= m_parser->m_functions.size()) break;
+				value.makeFunction(m_parser->m_functions[fnIdx]);
+				return true;
+			}
+			case varType_fnNative:
+			{
+				std::string_view name;
+				if(!loadChars(name)) return false;
+				const auto itr = std::find_if(m_natives.begin(), m_natives.end(), [name](const NativeFunction& n) { return n.name == name; });
+				if(itr == m_natives.end()) {
+					m_error = "the native function " + std::string(name) + " isn't registered";
+					return false;
+				}
+				value.makeNativeFunction(itr->fnPtr);
+				return true;
+			}
+			case varType_table:
+			case varType_array:
+			{
+				uint32_t objectIdx = 0;
+				if(!load(objectIdx)) return false;
+				if(objectIdx >= m_objects.size()) break;
+
+				GcObject* const object = m_objects[objectIdx];
+				value = Var((VarType)type);
+				if(type == varType_table && object->gcType == gcObjectType_table) {
+					value.m_table = static_cast<Table*>(object);
+					return true;
+				}
+				if(type == varType_array && object->gcType == gcObjectType_array) {
+					value.m_array = static_cast<Array*>(object);
+					return true;
+				}
+			}break;
+		}
+
+		m_error = "the file is corrupted";
+		return false;
+	}
+
+	Heap& m_heap;
+	const Parser* const m_parser;
+	const std::vector<NativeFunction>& m_natives;
+	std::string m_error;
+	std::vector<GcObject*> m_objects; // Indexed by the object indices used in the file.
+	std::unordered_map<std::string_view, StringRef> m_memberNames; // The views point into the file.
+
+	// The part of the file that wasn't read yet.
+	const char* m_in = nullptr;
+	const char* m_inEnd = nullptr;
+};
+
+// Parses JSON straight into tables and arrays. Objects become tables, true and false become 1 and 0 (like the results of comparisons),
+// and null becomes undefined. Numbers without a fraction or an exponent become integers, unless they are too big for one.
+// Like the ValueReader, nothing is collected while parsing.
+struct JsonReader
+{
+	static constexpr int kMaxDepth = 512;
+
+	explicit JsonReader(Heap& heap)
+		: m_heap(heap)
+	{}
+
+	bool read(const char* const data, const size_t size, Var& result, std::string& error) {
+		m_begin = m_p = data;
+		m_end = data + size;
+
+		skipWhitespace();
+		if(parseValue(result, 0)) {
+			skipWhitespace();
+			if(m_p != m_end) {
+				fail("unexpected characters after the value");
+			}
+		}
+
+		if(m_error.empty() == false) {
+			const size_t line = 1 + std::count(m_begin, m_errorPosition, '\n');
+			error = "line " + std::to_string(line) + ": " + m_error;
+			result = Var();
+			return false;
+		}
+		return true;
+	}
+
+private :
+
+	bool fail(const char* const message) {
+		if(m_error.empty()) {
+			m_error = message;
+			m_errorPosition = std::min(m_p, m_end);
+		}
+		return false;
+	}
+
+	void skipWhitespace() {
+		while(m_p < m_end && (*m_p == ' ' || *m_p == '\n' || *m_p == '\r' || *m_p == '\t')) {
+			++m_p;
+		}
+	}
+
+	// Consumes @word if the input continues with it.
+	bool consume(const std::string_view word) {
+		if((size_t)(m_end - m_p) >= word.size() && memcmp(m_p, word.data(), word.size()) == 0) {
+			m_p += word.size();
+			return true;
+		}
+		return false;
+	}
+
+	bool parseValue(Var& value, const int depth) {
+		if(m_p == m_end) {
+			return fail("unexpected end of the input");
+		}
+
+		switch(*m_p) {
+			case '{': return parseObject(value, depth);
+			case '[': return parseArray(value, depth);
+			case '"':
+			{
+				StringRef s;
+				if(!parseString(s, false)) return false;
+				value.makeString(std::move(s));
+				return true;
+			}
+			case 't': if(consume("true")) { value.makeInt64(1); return true; } break;
+			case 'f': if(consume("false")) { value.makeInt64(0); return true; } break;
+			case 'n': if(consume("null")) { value = Var(); return true; } break;
+			default: return parseNumber(value);
+		}
+
+		return fail("unexpected character");
+	}
+
+	bool parseObject(Var& value, const int depth) {
+		if(depth >= kMaxDepth) {
+			return fail("the values are nested too deeply");
+		}
+
+		++m_p; // '{'
+		Table* const table = m_heap.allocateTable();
+		value = Var(varType_table);
+		value.m_table = table;
+
+		skipWhitespace();
+		if(m_p < m_end && *m_p == '}') {
+			++m_p;
+			return true;
+		}
+
+		for(;;) {
+			skipWhitespace();
+			if(m_p == m_end || *m_p != '"') {
+				return fail("expected the name of a member");
+			}
+
+			StringRef key;
+			if(!parseString(key, true)) {
+				return false;
+			}
+
+			skipWhitespace();
+			if(m_p == m_end || *m_p != ':') {
+				return fail("expected ':'");
+			}
+			++m_p;
+			skipWhitespace();
+
+			Var member;
+			if(!parseValue(member, depth + 1)) {
+				return false;
+			}
+
+			const size_t sizeBefore = table->size();
+			*table->findOrInsert(key) = std::move(member);
+			if(table->size() != sizeBefore) {
+				m_heap.noteAllocation(sizeof(TableEntry));
+			}
+
+			skipWhitespace();
+			if(m_p < m_end && *m_p == ',') {
+				++m_p;
+				continue;
+			}
+			if(m_p < m_end && *m_p == '}') {
+				++m_p;
+				return true;
+			}
+			return fail("expected ',' or '}'");
+		}
+	}
+
+	bool parseArray(Var& value, const int depth) {
+		if(depth >= kMaxDepth) {
+			return fail("the values are nested too deeply");
+		}
+
+		++m_p; // '['
+		Array* const array = m_heap.allocateArray();
+		value = Var(varType_array);
+		value.m_array = array;
+
+		skipWhitespace();
+		if(m_p < m_end && *m_p == ']') {
+			++m_p;
+			return true;
+		}
+
+		Var element;
+		for(;;) {
+			skipWhitespace();
+			if(!parseValue(element, depth + 1)) {
+				return false;
+			}
+			array->pushBack(element);
+			m_heap.noteAllocation(sizeof(Var));
+
+			skipWhitespace();
+			if(m_p < m_end && *m_p == ',') {
+				++m_p;
+				continue;
+			}
+			if(m_p < m_end && *m_p == ']') {
+				++m_p;
+				return true;
+			}
+			return fail("expected ',' or ']'");
+		}
+	}
+
+	bool parseNumber(Var& value) {
+		const char* const first = m_p;
+		bool isInteger = true;
+		while(m_p < m_end && ((*m_p >= '0' && *m_p <= '9') || *m_p == '-' || *m_p == '+' || *m_p == '.' || *m_p == 'e' || *m_p == 'E')) {
+			isInteger = isInteger && *m_p != '.' && *m_p != 'e' && *m_p != 'E';
+			++m_p;
+		}
+
+		if(first == m_p || *first == '+') {
+			m_p = first;
+			return fail("unexpected character");
+		}
+
+		if(isInteger) {
+			int64_t i64 = 0;
+			const std::from_chars_result result = std::from_chars(first, m_p, i64);
+			if(result.ec == std::errc() && result.ptr == m_p) {
+				value.makeInt64(i64);
+				return true;
+			}
+		}
+
+		float f32 = 0.f;
+		const std::from_chars_result result = std::from_chars(first, m_p, f32);
+		if(result.ec != std::errc() || result.ptr != m_p) {
+			m_p = first;
+			return fail(result.ec == std::errc::result_out_of_range ? "the number is out of range" : "invalid number");
+		}
+		value.makeFloat32(f32);
+		return true;
+	}
+
+	// Member names repeat a lot (think of an array of records), so the equal ones share a buffer.
+	bool parseString(StringRef& s, const bool isMemberName) {
+		++m_p; // '"'
+
+		// Most strings have no escapes, those are copied straight from the input.
+		const char* const first = m_p;
+		while(m_p < m_end && *m_p != '"' && *m_p != '\\' && (unsigned char)*m_p >= 0x20) {
+			++m_p;
+		}
+
+		if(m_p < m_end && *m_p == '"') {
+			const std::string_view chars(first, m_p - first);
+			++m_p;
+
+			if(isMemberName) {
+				StringRef& name = m_memberNames[chars];
+				if(name.buffer() == nullptr) {
+					name = StringRef::fromChars(chars.data(), chars.size());
+					m_heap.noteAllocation(chars.size());
+				}
+				s = name;
+			} else {
+				s = StringRef::fromChars(chars.data(), chars.size());
+				m_heap.noteAllocation(chars.size());
+			}
+			return true;
+		}
+
+		m_scratch.assign(first, m_p - first);
+		while(m_p < m_end && *m_p != '"') {
+			const char c = *m_p++;
+			if((unsigned char)c < 0x20) {
+				--m_p;
+				return fail("control character in a string");
+			}
+
+			if(c != '\\') {
+				m_scratch.push_back(c);
+				continue;
+			}
+
+			if(m_p == m_end) {
+				break;
+			}
+
+			switch(*m_p++) {
+				case '"': m_scratch.push_back('"'); break;
+				case '\\': m_scratch.push_back('\\'); break;
+				case '/': m_scratch.push_back('/'); break;
+				case 'b': m_scratch.push_back('\b'); break;
+				case 'f': m_scratch.push_back('\f'); break;
+				case 'n': m_scratch.push_back('\n'); break;
+				case 'r': m_scratch.push_back('\r'); break;
+				case 't': m_scratch.push_back('\t'); break;
+				case 'u':
+				{
+					uint32_t codePoint = 0;
+					if(!parseHex4(codePoint)) {
+						return false;
+					}
+
+					// A surrogate pair encodes a code point above 0xFFFF, a lone surrogate becomes U+FFFD.
+					if(codePoint >= 0xD800 && codePoint <= 0xDBFF && consume("\\u")) {
+						uint32_t low = 0;
+						if(!parseHex4(low)) {
+							return false;
+						}
+						codePoint = (low >= 0xDC00 && low <= 0xDFFF) ? 0x10000 + ((codePoint - 0xD800) << 10) + (low - 0xDC00) : 0xFFFD;
+					}
+					else if(codePoint >= 0xD800 && codePoint <= 0xDFFF) {
+						codePoint = 0xFFFD;
+					}
+					appendUtf8(codePoint);
+				}break;
+				default:
+					--m_p;
+					return fail("invalid escape sequence");
+			}
+		}
+
+		if(m_p == m_end) {
+			return fail("unterminated string");
+		}
+		++m_p; // '"'
+
+		s = StringRef::fromChars(m_scratch.data(), m_scratch.size());
+		m_heap.noteAllocation(m_scratch.size());
+		return true;
+	}
+
+	bool parseHex4(uint32_t& value) {
+		if(m_end - m_p < 4) {
+			return fail("invalid escape sequence");
+		}
+
+		const std::from_chars_result result = std::from_chars(m_p, m_p + 4, value, 16);
+		if(result.ptr != m_p + 4) {
+			return fail("invalid escape sequence");
+		}
+		m_p += 4;
+		return true;
+	}
+
+	void appendUtf8(const uint32_t codePoint) {
+		if(codePoint < 0x80) {
+			m_scratch.push_back((char)codePoint);
+		} else if(codePoint < 0x800) {
+			m_scratch.push_back((char)(0xC0 | (codePoint >> 6)));
+			m_scratch.push_back((char)(0x80 | (codePoint & 0x3F)));
+		} else if(codePoint < 0x10000) {
+			m_scratch.push_back((char)(0xE0 | (codePoint >> 12)));
+			m_scratch.push_back((char)(0x80 | ((codePoint >> 6) & 0x3F)));
+			m_scratch.push_back((char)(0x80 | (codePoint & 0x3F)));
+		} else {
+			m_scratch.push_back((char)(0xF0 | (codePoint >> 18)));
+			m_scratch.push_back((char)(0x80 | ((codePoint >> 12) & 0x3F)));
+			m_scratch.push_back((char)(0x80 | ((codePoint >> 6) & 0x3F)));
+			m_scratch.push_back((char)(0x80 | (codePoint & 0x3F)));
+		}
+	}
+
+	Heap& m_heap;
+	const char* m_begin = nullptr;
+	const char* m_p = nullptr;
+	const char* m_end = nullptr;
+	std::string m_scratch; // The characters of a string with escapes.
+	std::unordered_map<std::string_view, StringRef> m_memberNames; // The views point into the input.
+	std::string m_error;
+	const char* m_errorPosition = nullptr;
+};
+
+//-----------------------------------------------------------------------------------------------------
+// Channels.
+// Scripts running on different threads (each on its own Executor) exchange values through channels. Sending a value moves
+// the tables and arrays reachable from it to the channel without copying them (see Heap::detachGraph), so the sender loses access to them,
+// and receiving it gives them to the heap of the receiver.
+//-----------------------------------------------------------------------------------------------------
+
+// A bounded queue of value graphs. Any number of threads could send and receive, the queue itself is lock-free:
+// a ring of slots where each slot has a sequence number telling if it is ready to be written or read at a given position.
+// Sending to a full channel waits until there is room for the value, so a fast sender is slowed down to the pace of its receivers.
+struct Channel
+{
+	// The capacity is at least 2, a ring of a single slot couldn't tell a full slot from an empty one.
+	explicit Channel(const size_t capacity)
+		: m_capacity(std::max<size_t>(capacity, 2))
+		, m_slots(new Slot[m_capacity])
+	{
+		for(size_t t = 0; t < m_capacity; ++t) {
+			m_slots[t].sequence.store(t, std::memory_order_relaxed);
+		}
+	}
+
+	Channel(const Channel&) = delete;
+	Channel& operator=(const Channel&) = delete;
+
+	// Returns false if the channel is full, @transfer is moved to the channel otherwise.
+	bool trySend(HeapTransfer& transfer) {
+		size_t position = m_sendPosition.load(std::memory_order_relaxed);
+		Slot* slot = nullptr;
+		for(;;) {
+			slot = &m_slots[position % m_capacity];
+			const size_t sequence = slot->sequence.load(std::memory_order_acquire);
+			const intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+			if(difference == 0) {
+				if(m_sendPosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+					break;
+				}
+			} else if(difference < 0) {
+				return false; // The slot still holds the value sent one lap ago.
+			} else {
+				position = m_sendPosition.load(std::memory_order_relaxed); // Another sender took this position.
+			}
+		}
+
+		slot->transfer = std::move(transfer);
+		slot->sequence.store(position + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Returns false if the channel is empty.
+	bool tryReceive(HeapTransfer& transfer) {
+		size_t position = m_receivePosition.load(std::memory_order_relaxed);
+		Slot* slot = nullptr;
+		for(;;) {
+			slot = &m_slots[position % m_capacity];
+			const size_t sequence = slot->sequence.load(std::memory_order_acquire);
+			const intptr_t difference = (intptr_t)sequence - (intptr_t)(position + 1);
+			if(difference == 0) {
+				if(m_receivePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+					break;
+				}
+			} else if(difference < 0) {
+				return false; // Nothing was sent at this position yet.
+			} else {
+				position = m_receivePosition.load(std::memory_order_relaxed); // Another receiver took this position.
+			}
+		}
+
+		transfer = std::move(slot->transfer);
+		slot->sequence.store(position + m_capacity, std::memory_order_release);
+		return true;
+	}
+
+	// Waits for room in the channel. Returns false if the channel is closed, the value isn't sent then.
+	// @onWait() is called before each wait, it could throw to stop waiting.
+	template<typename TOnWait>
+	bool send(HeapTransfer&& transfer, TOnWait&& onWait) {
+		for(int attempt = 0; ; ++attempt) {
+			if(isClosed()) {
+				return false;
+			}
+			if(trySend(transfer)) {
+				return true;
+			}
+			onWait();
+			wait(attempt);
+		}
+	}
+
+	// Waits for a value. Returns false once the channel is closed and every value sent before closing it was received.
+	// @onWait() is called before each wait, it could throw to stop waiting.
+	template<typename TOnWait>
+	bool receive(HeapTransfer& transfer, TOnWait&& onWait) {
+		for(int attempt = 0; ; ++attempt) {
+			if(tryReceive(transfer)) {
+				return true;
+			}
+			if(isClosed()) {
+				return tryReceive(transfer); // A value could have been sent right before closing.
+			}
+			onWait();
+			wait(attempt);
+		}
+	}
+
+	// Tells the receivers that nothing else is going to be sent, and wakes up the senders that wait for room.
+	// It should be called by the sender after its last send, the values sent concurrently with closing could be dropped.
+	void close() {
+		m_isClosed.store(true, std::memory_order_release);
+	}
+
+	bool isClosed() const {
+		return m_isClosed.load(std::memory_order_acquire);
+	}
+
+private :
+
+	// Spins for a short wait, then yields and sleeps for longer and longer. There is no lock to block on,
+	// and a stage of a pipeline usually gets what it waits for soon.
+	static void wait(const int attempt) {
+		if(attempt < 16) {
+			return;
+		}
+		if(attempt < 64) {
+			std::this_thread::yield();
+			return;
+		}
+		std::this_thread::sleep_for(std::chrono::microseconds(std::min(1000, 10 * (attempt - 63))));
+	}
+
+	struct Slot
+	{
+		std::atomic<size_t> sequence;
+		HeapTransfer transfer;
+	};
+
+	const size_t m_capacity;
+	std::unique_ptr<Slot[]> m_slots;
+
+	// On their own cache lines, as senders and receivers update them from different cores.
+	alignas(64) std::atomic<size_t> m_sendPosition{0};
+	alignas(64) std::atomic<size_t> m_receivePosition{0};
+	alignas(64) std::atomic<bool> m_isClosed{false};
+};
+
+// The channels shared by a group of Executors, like the stages of a pipeline (see Executor::channels). Scripts refer to a channel
+// by its index in the group, and the Executors find the same channel by opening it with the same name (see the channel_open builtin).
+// The channels live as long as the group, so looking one up doesn't take a lock.
+struct ChannelGroup
+{
+	static constexpr size_t kMaxChannels = 256;
+
+	// @isShared tells if the group is used by more than one Executor. Otherwise nobody else could fill or empty its channels,
+	// so there is no point in waiting on them.
+	explicit ChannelGroup(const bool isShared)
+		: isShared(isShared)
+	{}
+
+	ChannelGroup(const ChannelGroup&) = delete;
+	ChannelGroup& operator=(const ChannelGroup&) = delete;
+
+	~ChannelGroup() {
+		for(std::atomic<Channel*>& channel : m_channels) {
+			delete channel.load(std::memory_order_relaxed);
+		}
+	}
+
+	// Returns the id of the channel named @name, it is created with @capacity if there is none. Returns -1 if there are too many channels.
+	int64_t open(const std::string& name, const size_t capacity) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		const auto itr = m_idsByName.find(name);
+		if(itr != m_idsByName.end()) {
+			return itr->second;
+		}
+
+		const size_t id = m_count.load(std::memory_order_relaxed);
+		if(id >= kMaxChannels) {
+			return -1;
+		}
+
+		m_channels[id].store(new Channel(capacity), std::memory_order_release);
+		m_count.store(id + 1, std::memory_order_release);
+		m_idsByName[name] = (int64_t)id;
+		return (int64_t)id;
+	}
+
+	// Returns null if there is no channel with that id.
+	Channel* find(const int64_t id) const {
+		if(id < 0 || id >= (int64_t)m_count.load(std::memory_order_acquire)) {
+			return nullptr;
+		}
+		return m_channels[id].load(std::memory_order_acquire);
+	}
+
+	// Closes every channel, so the scripts that wait on one of them stop waiting.
+	void closeAll() {
+		const size_t count = m_count.load(std::memory_order_acquire);
+		for(size_t t = 0; t < count; ++t) {
+			m_channels[t].load(std::memory_order_acquire)->close();
+		}
+	}
+
+	const bool isShared;
+
+private :
+
+	std::mutex m_mutex; // Taken when opening a channel.
+	std::unordered_map<std::string, int64_t> m_idsByName;
+	std::atomic<Channel*> m_channels[kMaxChannels] = {};
+	std::atomic<size_t> m_count{0};
+};
+
+// Script functions belong to the program of the Executor that created them, so they can't be sent to another one.
+inline bool containsScriptFunction(const Var& root) {
+	std::unordered_set<const GcObject*> visited;
+	std::vector<const Var*> pending = {&root};
+	bool isFound = false;
+	while(pending.empty() == false && isFound == false) {
+		const Var* const var = pending.back();
+		pending.pop_back();
+
+		if(var->m_varType == varType_fn) {
+			isFound = true;
+		}
+		else if(var->m_varType == varType_table && var->m_table && visited.insert(var->m_table).second) {
+			var->m_table->forEach([&pending](const TableEntry& entry) { pending.push_back(&entry.value); });
+		}
+		else if(var->m_varType == varType_array && var->m_array && visited.insert(var->m_array).second) {
+			var->m_array->forEach([&pending](const Var& value) { pending.push_back(&value); });
+		}
+	}
+	return isFound;
+}
+
+// The global variable with a given name, if any. Variables are never removed from Executor::m_variablesLut,
+// so once a name gets used in some scope, its global has to be looked up by name with the scope rules.
+struct GlobalSlot
+{
+	Var* var = nullptr;
+	bool isShadowed = false;
+};
+
+// A callback used by the host when a script runs out of fuel (see Executor::setFuel).
+// Returns the fuel that the script gets for continuing, or 0 to abort it.
+typedef int64_t (*FuelExhaustedFn)(Executor* exec, void* userData);
+
+// The executor itself.
+// Takes and AST node and executes.
+struct Executor
+{
+	Executor() {
+		addStnadardLibFunctions();
+	}
+
+	void pushScope(const AstNode* const node, const char* const postfix)
+	{
+		std::stringstream uniqueIdSS;
+		uniqueIdSS << (size_t)(AstNode*)node;
+		if(postfix) {
+			uniqueIdSS << postfix;
+		}
+
+		std::string fullScope = !m_scopeStack.empty() 
+			? m_scopeStack.back() + " " + uniqueIdSS.str()
+			: uniqueIdSS.str();
+
+		m_scopeStack.emplace_back(std::move(fullScope));
+	}
+
+	void popScope()
+	{
+		if(m_scopeStack.empty()) {
+			ThrowError(Location(), "Internal Error: Wrong scope pop");
+		}
+		m_scopeStack.pop_back();
+	}
+
+	// Allocates a new variable in the heap. Named variables are reachable through m_variablesLut,
+	// unnamed ones are temporaries and stay alive until the statement that created them is done (see m_tempRoots).
+	Var* newVariableRaw(const char* nameCStr, const VarType varType) {
+		
+		Var* const result = &m_heap.allocateCell()->var;
+		result->m_varType = varType;
+
+		if(varType == varType_table) {
+			result->m_table = m_heap.allocateTable();
+		}
+
+		if(varType == varType_array) {
+			result->m_array = m_heap.allocateArray();
+		}
+		
+		if(nameCStr!=nullptr) {
+			//result->m_name = name;
+			m_variablesLut[nameCStr] = result;
+		} else {
+			m_tempRoots.push_back(result);
+		}
+		return result;
+	}
+
+	// Creates a temporary table with space for @expectedSize members in the table allocation itself.
+	Var* newVariableTable(const size_t expectedSize) {
+		Var* var = newVariableRaw(nullptr, varType_undefined);
+		var->m_varType = varType_table;
+		var->m_table = m_heap.allocateTable(expectedSize);
+		return var;
+	}
+
+	Var* newVariableFloat(float v) {
+		Var* var = newVariableRaw(nullptr, (VarType)0); // HACK
+		var->makeFloat32(v);
+		return var;
+	}
+
+	Var* newVariableInt64(int64_t v) {
+		Var* var = newVariableRaw(nullptr, varType_undefined);
+		var->makeInt64(v);
+		return var;
+	}
+
+	// The result of comparisons and logical operations.
+	Var* newVariableBool(bool v) {
+		return newVariableInt64(v ? 1 : 0);
+	}
+
+	Var* newVariableString(StringRef v) {
+		Var* var = newVariableRaw(nullptr, (VarType)0);
+		var->makeString(std::move(v));
+		m_heap.noteAllocation(Heap::stringBytes(*var));
+		return var;
+	}
+
+	Var* newVariableCopy(const Var& v) {
+		Var* var = newVariableRaw(nullptr, varType_undefined);
+		*var = v;
+		return var;
+	}
+
+	Var* newVariableFunction(const AstFnDecl* const fnDecl) {
+		Var* var = newVariableRaw(nullptr, (VarType)0);
+		var->makeFunction(fnDecl);
+		return var;
+	}
+
+	Var* newVariableNativeFunction(const char* name, NativeFnPtr fnPtr) {
+		Var* var = newVariableRaw(name, (VarType)0);
+		var->makeNativeFunction(fnPtr);
+		const int symbol = Symbols::intern(name);
+		if(symbol != Symbols::kNoSymbol) {
+			globalSlot(symbol).var = var;
+		}
+
+		// Registering a name again replaces the function.
+		const NativeFunction native = {name, fnPtr, var, symbol};
+		auto itr = std::find_if(m_nativeFunctions.begin(), m_nativeFunctions.end(), [name](const NativeFunction& n) { return n.name == name; });
+		if(itr != m_nativeFunctions.end()) {
+			*itr = native;
+		} else {
+			m_nativeFunctions.push_back(native);
+		}
+		return var;
+	}
+
+	NativeFnPtr findNativeFunction(const std::string_view name) const {
+		for(const NativeFunction& native : m_nativeFunctions) {
+			if(native.name == name) {
+				return native.fnPtr;
+			}
+		}
+		return nullptr;
+	}
+
+	GlobalSlot& globalSlot(const int symbol) {
+		assert(symbol != Symbols::kNoSymbol);
+		if(symbol >= (int)m_globalSlots.size()) {
+			m_globalSlots.resize(symbol + 1);
+		}
+		return m_globalSlots[symbol];
+	}
+
+	// The @symbol is the one of @baseName (see Symbols).
+	Var* findVariableInScope(const std::string& baseName, const int symbol, bool createUndefinedIfMissing, bool shouldGoUpwardsIfMIssing) {
+
+		for(int t = (int)(m_scopeStack.size()) - 1; t != -2; --t)
+		{
+			std::string name = (t == -1) ? baseName : m_scopeStack[t] + " " + baseName;;
+		
+			auto itr = m_variablesLut.find(name);
+			if(itr == std::end(m_variablesLut)) {
+
+				if(createUndefinedIfMissing) {
+					Var* const result = newVariableRaw(name.c_str(), varType_undefined);
+
+					if(symbol != Symbols::kNoSymbol) {
+						GlobalSlot& slot = globalSlot(symbol);
+						if(t == -1) {
+							slot.var = result;
+						} else {
+							slot.isShadowed = true;
+						}
+					}
+
+					return result;
+				}
+			} else {
+				return itr->second;
+			}
+
+			if(shouldGoUpwardsIfMIssing == false)
+				return nullptr;
+		}
+
+		return nullptr;
+	}
+
+	Var* evaluateIdentifier(const AstIdentifier* const n) {
+		// Global variables and builtins that no scope has a variable with the same name, are accessed directly.
+		if(n->symbol != Symbols::kNoSymbol && n->symbol < (int)m_globalSlots.size()) {
+			const GlobalSlot& slot = m_globalSlots[n->symbol];
+			if(slot.var && !slot.isShadowed) {
+				return slot.var;
+			}
+		}
+
+		Var* result = findVariableInScope(n->identifier, n->symbol, false, true);
+		if(!result) {
+			result = findVariableInScope(n->identifier, n->symbol, true, false);
+		}
+		return result;
+	}
+
+	// Assigns a value to a variable that could be reachable by the script, keeping the garbage collector informed.
+	void assignVar(Var* const dst, const Var& src) {
+		m_heap.writeBarrier(*dst);
+		*dst = src;
+	}
+
+	// Drops the temporaries created after the specified point (see m_tempRoots).
+	void releaseTempRoots(const size_t watermark) {
+		if(m_tempRoots.size() > watermark) {
+			m_tempRoots.resize(watermark);
+		}
+	}
+
+	// Keeps a copy of a value rooted while a native calls back into the script, which could reassign the variable the value came from
+	// (array_map holds a pointer to the array while fn runs). The temporaries created after it are dropped with it.
+	struct TempRoot
+	{
+		TempRoot(Executor* const exec, const Var& value) : m_exec(exec), m_watermark(exec->m_tempRoots.size()) {
+			exec->newVariableCopy(value);
+		}
+
+		~TempRoot() {
+			m_exec->releaseTempRoots(m_watermark);
+		}
+
+		TempRoot(const TempRoot&) = delete;
+		TempRoot& operator=(const TempRoot&) = delete;
+
+	private :
+		Executor* const m_exec;
+		const size_t m_watermark;
+	};
+
+	// Limits how much work the script could do from now on. Each loop iteration and each function call burns a unit of fuel.
+	// When the fuel runs out, the handler set by setFuelExhaustedHandler decides if the script continues.
+	void setFuel(const int64_t fuel) {
+		m_fuel = fuel;
+	}
+
+	// Sets the fuel and the hard memory limit (see Heap::hardLimitBytes), SIZE_MAX for no memory limit.
+	// The soft limit is set below the hard one, so the garbage gets collected before the script is close to failing.
+	void setLimits(const int64_t fuel, const size_t heapLimit) {
+		setFuel(fuel);
+		m_heap.hardLimitBytes = heapLimit;
+		m_heap.softLimitBytes = (heapLimit != SIZE_MAX) ? heapLimit / 4 * 3 : SIZE_MAX;
+	}
+
+	int64_t fuelLeft() const {
+		return m_fuel;
+	}
+
+	// The handler could pause the script, by blocking until it is the turn of the script to run again, and then give it more fuel.
+	// Without a handler, or if it gives no more fuel, the script is aborted with an error.
+	void setFuelExhaustedHandler(FuelExhaustedFn const handler, void* const userData) {
+		m_fuelExhaustedFn = handler;
+		m_fuelExhaustedUserData = userData;
+	}
+
+	ChannelGroup& channels() {
+		if(m_channels == nullptr) {
+			m_ownChannels.reset(new ChannelGroup(false));
+			m_channels = m_ownChannels.get();
+		}
+		return *m_channels;
+	}
+
+	// Called on loop back-edges and function calls, where the script could be stopped.
+	void burnFuel(const Location& location) {
+		if(--m_fuel < 0) {
+			refuel(location);
+		}
+	}
+
+	void refuel(const Location& location) {
+		m_fuel = m_fuelExhaustedFn ? m_fuelExhaustedFn(this, m_fuelExhaustedUserData) : 0;
+		if(m_fuel <= 0) {
+			m_fuel = 0;
+			ThrowError(location, "The script ran out of fuel");
+		}
+	}
+
+	// Executes a whole program, with its code compiled ahead of time if @compiledProgram is given (see AotModule).
+	// If the script fails or runs out of fuel, the scopes and temporaries of the script are dropped,
+	// so the Executor could run something else.
+	void run(const AstNode* const program, AotCompiledFn const compiledProgram) {
+		runGuarded([&]() {
+			if(compiledProgram) {
+				compiledProgram(this);
+			} else {
+				EvalCtx ctx;
+				evaluate(program, ctx);
+			}
+		});
+	}
+
+	// Calls the global function @name without arguments, for example the entry point of a script restored from a snapshot (see HeapSnapshot).
+	// Like run, the Executor could still be used if the script fails.
+	void callGlobal(const std::string& name) {
+		const size_t tempRootsWatermark = m_tempRoots.size();
+		runGuarded([&]() {
+			const Var* const fn = findVariableInScope(name, Symbols::intern(name), false, false);
+			if(fn == nullptr) {
+				ThrowError(Location(), "Unknown global function " + name);
+			}
+			callFunction(fn, 0, nullptr, Location());
+		});
+		releaseTempRoots(tempRootsWatermark);
+	}
+
+	// Brings the Executor back to the state it had once its native functions were registered, so it could run another script
+	// without constructing a new one (see ExecutorPool). The variables of the previous scripts are dropped and freed,
+	// the natives that were reassigned get their functions back, and the limits and the output go back to the defaults.
+	// The cost is a garbage collection where only the natives are alive.
+	void reset() {
+		// The limits go first, the previous script might have failed for going over them.
+		m_heap.softLimitBytes = SIZE_MAX;
+		m_heap.hardLimitBytes = SIZE_MAX;
+		m_heap.statementLocation = Location();
+		m_output.redirect(nullptr, nullptr);
+		m_channels = nullptr;
+		m_ownChannels.reset();
+		m_scopeStack.clear();
+		m_tempRoots.clear();
+		m_callDepth = 0;
+
+		m_variablesLut.clear();
+		std::fill(m_globalSlots.begin(), m_globalSlots.end(), GlobalSlot());
+		for(const NativeFunction& native : m_nativeFunctions) {
+			Var fn;
+			fn.makeNativeFunction(native.fnPtr);
+			assignVar(native.var, fn);
+			m_variablesLut[native.name] = native.var;
+			if(native.symbol != Symbols::kNoSymbol) {
+				globalSlot(native.symbol).var = native.var;
+			}
+		}
+
+		collectGarbage();
+		m_heap.resetPeak();
+
+		m_fuel = INT64_MAX;
+		m_fuelExhaustedFn = nullptr;
+		m_fuelExhaustedUserData = nullptr;
+	}
+
+	// Calls @fn(), dropping the scopes, temporaries and calls that it leaves behind if it throws.
+	template<typename TFn>
+	void runGuarded(TFn&& fn) {
+		const size_t scopeDepth = m_scopeStack.size();
+		const size_t tempRootsWatermark = m_tempRoots.size();
+		const int callDepth = m_callDepth;
+		try {
+			fn();
+		}
+		catch(...) {
+			m_scopeStack.resize(scopeDepth);
+			releaseTempRoots(tempRootsWatermark);
+			m_callDepth = callDepth;
+			throw;
+		}
+	}
+
+	// Called between statements and loop iterations, where every value that is still in use is reachable from the roots.
+	// Starts a garbage collection cycle if needed and performs a small step of the one that is in progress.
+	// This is also where the memory limit is enforced, @location is the statement that is about to be executed.
+	void gcSafePoint(const Location& location) {
+		m_heap.statementLocation = location;
+		if(m_heap.isOverHardLimit()) {
+			collectGarbage();
+			if(m_heap.isOverHardLimit()) {
+				ThrowError(location, "The script exceeded its memory limit");
+			}
+		}
+
+		if(m_heap.isCollecting() == false) {
+			if(m_heap.shouldStartCycle() == false) {
+				return;
+			}
+
+			m_heap.beginCycle();
+			markRoots();
+		}
+
+		m_heap.step();
+	}
+
+	// Performs a full garbage collection. Could be used by the host between script runs.
+	void collectGarbage() {
+		m_heap.finishCycle();
+		m_heap.beginCycle();
+		markRoots();
+		m_heap.finishCycle();
+	}
+
+	void markRoots() {
+		for(const auto& pair : m_variablesLut) {
+			m_heap.markCell(VarCell::fromVar(pair.second));
+		}
+
+		for(Var* const var : m_tempRoots) {
+			m_heap.markCell(VarCell::fromVar(var));
+		}
+	}
+
+	struct EvalCtx
+	{
+		Var* forcedResult = nullptr; // used by return statements to pass the result.
+		Var* const* inlinedArguments = nullptr; // The arguments of the inlined function that is being evaluated.
+	};
+
+	// Calls a script or a native function with already evaluated arguments. Natives use this to call back into the script.
+	// The result is never null, functions that do not return anything produce an undefined temporary.
+	Var* callFunction(const Var* const fn, const int argc, Var* argv[], const Location& location)
+	{
+		if(fn && fn->m_varType == varType_fn)
+		{
+			// Validate that the number of arguments is correct.
+			if(argc != fn->m_fnDecl->argsNames.size()) {
+				ThrowError(location, "Wrong number of arguments specified to a function call");
+			}
+
+			return callScriptFunction(fn->m_fnDecl, argc, argv);
+		}
+		else if(fn && fn->m_varType == varType_fnNative)
+		{
+			if(fn->m_fnNative != nullptr)
+			{
+				Var* result = nullptr;
+				bool isSuccessful = false;
+				try {
+					isSuccessful = fn->m_fnNative(argc, argv, this, &result);
+				}
+				catch(Error& e) {
+					// Natives don't know where they were called from.
+					if(e.location.line < 0) {
+						e.location = location;
+					}
+					throw;
+				}
+
+				if(isSuccessful) {
+					return result ? result : newVariableRaw(nullptr, varType_undefined);
+				} else {
+					ThrowError(location, "Failed on native function call");
+				}
+			}
+		}
+
+		ThrowError(location, "Uknown function call");
+	}
+
+	// How deep the script functions could call each other. Each call takes a few C++ frames of evaluate (about 1-2KB
+	// at -O2 for usual function bodies), so this stays well within the 8MB stack of the main and the worker threads.
+	static constexpr int kMaxCallDepth = 2000;
+
+	// Calls a script function, the number of arguments must already be validated.
+	Var* callScriptFunction(const AstFnDecl* const fnToCallDecl, const int argc, Var* argv[])
+	{
+		if(m_callDepth >= kMaxCallDepth) {
+			ThrowError(fnToCallDecl->location, "Too much recursion");
+		}
+
+		burnFuel(fnToCallDecl->location);
+		++m_callDepth;
+
+		// Set the function arguments variable and call the function.
+		pushScope(fnToCallDecl, nullptr);
+
+		for(int iArg = 0; iArg < argc; ++iArg) {
+			Var* const arg = findVariableInScope(fnToCallDecl->argsNames[iArg], fnToCallDecl->argsSymbols[iArg], true, false);
+			assignVar(arg, *argv[iArg]);
+		}
+
+		Var* result = nullptr;
+		if(fnToCallDecl->compiledBody) {
+			result = fnToCallDecl->compiledBody(this);
+		} else {
+			EvalCtx fnCtx;
+			evaluate(fnToCallDecl->fnBodyBlock, fnCtx);
+			result = fnCtx.forcedResult;
+		}
+
+		popScope();
+		--m_callDepth;
+
+		if(result == nullptr) {
+			return newVariableRaw(nullptr, varType_undefined);
+		}
+
+		return result;
+	}
+
+	// Integer operations stay exact. When the result doesn't fit in an integer (or a division isn't exact),
+	// the operation is done in double precision and the result is a float.
+	template<typename T>
+	static bool compareValues(const BinOpOperation operation, const T a, const T b) {
+		switch(operation) {
+			case binOpOperation_equals: return a == b;
+			case binOpOperation_notEquals: return a != b;
+			case binOpOperation_lessEquals: return a <= b;
+			case binOpOperation_greaterEquals: return a >= b;
+			case binOpOperation_less: return a < b;
+			case binOpOperation_greater: return a > b;
+			default: assert(false); return false;
+		}
+	}
+
+	// Evaluates the condition of if, while and for. Comparisons are done directly, without creating a variable for the result.
+	bool evaluateCondition(const AstNode* const expression, EvalCtx& ctx) {
+		if(expression->type == astNodeType_binop) {
+			const AstBinOp* const n = (AstBinOp*)expression;
+			if(n->operation >= binOpOperation_equals) {
+				const Var* const left = evaluate(n->left, ctx);
+				const Var* const right = evaluate(n->right, ctx);
+				return compareOperands(n, left, right);
+			}
+		}
+
+		return evaluate(expression, ctx)->isTrue();
+	}
+
+	// The comparison @n (see BinOpOperation) of already evaluated operands, without making a variable for the result.
+	static bool compareOperands(const AstBinOp* const n, const Var* const left, const Var* const right) {
+		if(left->m_varType == varType_i64 && right->m_varType == varType_i64) {
+			return compareValues(n->operation, left->m_value_i64, right->m_value_i64);
+		}
+
+		if(left->isNumber() && right->isNumber()) {
+			return compareValues(n->operation, left->asFloat32(), right->asFloat32());
+		}
+
+		if(left->m_varType == varType_string && right->m_varType == varType_string && n->operation == binOpOperation_equals) {
+			return left->m_value_string == right->m_value_string;
+		}
+
+		ThrowError(n->location, "Uknown/Unimplemented binary operation");
+	}
+
+	Var* evaluateInt64BinOp(const BinOpOperation operation, const int64_t a, const int64_t b) {
+		int64_t r = 0;
+		switch(operation) {
+			case binOpOperation_add: return checkedAdd(a, b, r) ? newVariableInt64(r) : newVariableFloat(float((double)a + (double)b));
+			case binOpOperation_sub: return checkedSub(a, b, r) ? newVariableInt64(r) : newVariableFloat(float((double)a - (double)b));
+			case binOpOperation_mul: return checkedMul(a, b, r) ? newVariableInt64(r) : newVariableFloat(float((double)a * (double)b));
+			case binOpOperation_div:
+				if(b != 0 && !(a == INT64_MIN && b == -1) && a % b == 0) return newVariableInt64(a / b);
+				return newVariableFloat(float((double)a / (double)b));
+			case binOpOperation_none: break;
+			default: return newVariableBool(compareValues(operation, a, b));
+		}
+		return nullptr;
+	}
+
+	Var* evaluateFloat32BinOp(const BinOpOperation operation, const float a, const float b) {
+		switch(operation) {
+			case binOpOperation_add: return newVariableFloat(a + b);
+			case binOpOperation_sub: return newVariableFloat(a - b);
+			case binOpOperation_mul: return newVariableFloat(a * b);
+			case binOpOperation_div: return newVariableFloat(a / b);
+			case binOpOperation_none: break;
+			default: return newVariableBool(compareValues(operation, a, b));
+		}
+		return nullptr;
+	}
+
+	// Quickening: a generic binary operation that keeps seeing the same types of operands gets a guarded specialized form.
+	static const uint8_t kQuickeningWarmup = 16;
+	static const uint8_t kMaxDeopts = 4;
+	static const uint8_t kMaxInlineCacheMisses = 16;
+
+	static void recordBinOpFeedback(const AstBinOp* const n, const Var* const left, const Var* const right) {
+		BinOpFeedback& feedback = n->feedback;
+		if(feedback.isDisabled) {
+			return;
+		}
+
+		if(feedback.hits == 0 || feedback.leftType != left->m_varType || feedback.rightType != right->m_varType) {
+			feedback.leftType = (uint8_t)left->m_varType;
+			feedback.rightType = (uint8_t)right->m_varType;
+			feedback.hits = 0;
+		}
+
+		if(++feedback.hits < kQuickeningWarmup) {
+			return;
+		}
+
+		const bool isArithmeticOrComparison = n->operation != binOpOperation_none;
+		if(left->m_varType == varType_i64 && right->m_varType == varType_i64 && isArithmeticOrComparison) n->form = binOpForm_guardedI64;
+		else if(left->m_varType == varType_f32 && right->m_varType == varType_f32 && isArithmeticOrComparison) n->form = binOpForm_guardedF32;
+		else if(left->isNumber() && right->isNumber() && isArithmeticOrComparison) n->form = binOpForm_guardedNumber;
+		else if(left->m_varType == varType_string && right->m_varType == varType_string && n->operation == binOpOperation_add) n->form = binOpForm_guardedStringConcat;
+		else if(left->m_varType == varType_string && right->m_varType == varType_string && n->operation == binOpOperation_equals) n->form = binOpForm_guardedStringEquals;
+		else feedback.isDisabled = true; // Nothing to specialize for these types.
+	}
+
+	// Called when a quickened operation sees unexpected types. Sites that keep changing their types stay generic.
+	static void deoptimizeBinOp(const AstBinOp* const n) {
+		n->form = binOpForm_generic;
+		n->feedback.hits = 0;
+		if(++n->feedback.deopts >= kMaxDeopts) {
+			n->feedback.isDisabled = true;
+		}
+	}
+
+	// Points the cache of the call site to the specified function (see AstFnCall::cachedFn), returns false if the number of arguments
+	// doesn't match. If the call site starts calling something else (the variable holding the function got reassigned),
+	// the site could inline the new function. Sites that keep changing their function aren't inlined anymore.
+	static bool bindCallSite(const AstFnCall* const n, const AstFnDecl* const fnDecl) {
+		static const uint8_t kMaxCallSiteMisses = 4;
+
+		if(n->callArgs.size() != fnDecl->argsNames.size()) {
+			return false;
+		}
+
+		if(n->cachedFn != nullptr && n->cacheMisses < kMaxCallSiteMisses) {
+			n->cacheMisses++;
+		}
+
+		n->cachedFn = fnDecl;
+		n->inlinedBody = (n->cacheMisses < kMaxCallSiteMisses) ? Inliner::getInlineBody(fnDecl) : nullptr;
+		return true;
+	}
+
+	// Returns the script function that @fn refers to if it could be called from the call site without further checks, nullptr otherwise.
+	// Calls to the same function as last time skip the validation (see AstFnCall::cachedFn).
+	static const AstFnDecl* resolveCallSite(const AstFnCall* const n, const Var* const fn) {
+		if(fn && fn->m_varType == varType_fn && (n->cachedFn == fn->m_fnDecl || bindCallSite(n, fn->m_fnDecl))) {
+			return n->cachedFn;
+		}
+		return nullptr;
+	}
+
+	// Evaluates a call site with the inlined body of the cached function (see Inliner).
+	Var* evaluateInlinedCall(const AstFnCall* const n, EvalCtx& ctx) {
+		const AstNode* const body = n->inlinedBody;
+
+		Var* arguments[Inliner::kMaxArguments];
+		for(size_t t = 0; t < n->callArgs.size(); ++t) {
+			arguments[t] = evaluate(n->callArgs[t], ctx);
+		}
+
+		Var* const* const outerArguments = ctx.inlinedArguments;
+		ctx.inlinedArguments = arguments;
+		Var* result = evaluate(body, ctx);
+		ctx.inlinedArguments = outerArguments;
+
+		// Like a return statement, give the caller its own copy, unless the result is already a new temporary.
+		if(body->type != astNodeType_binop && body->type != astNodeType_unop) {
+			result = newVariableCopy(*result);
+		}
+
+		return result;
+	}
+
+	// Evaluates the array and the index of an array indexing. The index is validated.
+	Array* evaluateIndexedArray(const AstArrayIndexing* const n, EvalCtx& ctx, size_t& outIdx)
+	{
+		Var* const array = evaluate(n->theArray, ctx);
+		if(array && array->m_varType == varType_array)
+		{
+			Var* const varIndex = evaluate(n->index, ctx);
+
+			// Integer indices are used as they are, float ones are truncated.
+			if(varIndex && varIndex->isNumber()) {
+				const int64_t idx = (varIndex->m_varType == varType_i64) ? varIndex->m_value_i64 : (int64_t)varIndex->m_value_f32;
+				if(idx < 0 || idx >= (int64_t)array->m_array->size()) {
+					ThrowError(n->location, "Out of bounds array indexing");
+				}
+				outIdx = idx;
+				return array->m_array;
+			} else {
+				ThrowError(n->location, "Array index must be a number");
+			}
+		}
+
+		ThrowError(n->location, "Only arrays can be indexed");
+	}
+
+	// Evaluates <left>.<member>, the member is created if the table doesn't have it.
+	Var* evaluateMemberAccess(const AstMemberAcess* const n, Var* const left) {
+		if(left->m_varType != varType_table || !left->m_table) {
+			ThrowError(n->location, "Only tables have members");
+			return nullptr;
+		}
+
+		Table* const table = left->m_table;
+
+		// Check the inline cache first.
+		const uint32_t cachedIndex = n->cachedEntryIndex;
+		if(cachedIndex < table->size()) {
+			TableEntry* const entry = table->entryAt(cachedIndex);
+			if(entry->key == n->memberName) {
+				return &entry->value;
+			}
+		}
+
+		const size_t sizeBefore = table->size();
+		TableEntry* const entry = table->findOrInsertEntry(n->memberName);
+		if(table->size() != sizeBefore) {
+			m_heap.noteAllocation(sizeof(TableEntry));
+		}
+
+		if(n->cacheMisses < kMaxInlineCacheMisses) {
+			n->cacheMisses += (cachedIndex != UINT32_MAX);
+			n->cachedEntryIndex = (n->cacheMisses < kMaxInlineCacheMisses) ? table->indexOfEntry(entry) : UINT32_MAX;
+		}
+
+		return &entry->value;
+	}
+
+	Var* evaluateBinOp(const AstBinOp* const n, const Var* const left, const Var* const right) {
+		// The specialized forms trust the types proven by TypeInference.
+		switch(n->form)
+		{
+			case binOpForm_i64:
+				return evaluateInt64BinOp(n->operation, left->m_value_i64, right->m_value_i64);
+			case binOpForm_f32:
+				return evaluateFloat32BinOp(n->operation, left->m_value_f32, right->m_value_f32);
+			case binOpForm_number:
+				if(left->m_varType == varType_i64 && right->m_varType == varType_i64) {
+					return evaluateInt64BinOp(n->operation, left->m_value_i64, right->m_value_i64);
+				}
+				return evaluateFloat32BinOp(n->operation, left->asFloat32(), right->asFloat32());
+			case binOpForm_stringConcat:
+				return newVariableString(StringRef::concat(left->m_value_string, right->m_value_string));
+			case binOpForm_stringEquals:
+				return newVariableBool(left->m_value_string == right->m_value_string);
+			case binOpForm_guardedI64:
+				if(left->m_varType == varType_i64 && right->m_varType == varType_i64) {
+					return evaluateInt64BinOp(n->operation, left->m_value_i64, right->m_value_i64);
+				}
+				deoptimizeBinOp(n);
+				break;
+			case binOpForm_guardedF32:
+				if(left->m_varType == varType_f32 && right->m_varType == varType_f32) {
+					return evaluateFloat32BinOp(n->operation, left->m_value_f32, right->m_value_f32);
+				}
+				deoptimizeBinOp(n);
+				break;
+			case binOpForm_guardedNumber:
+				if(left->m_varType == varType_i64 && right->m_varType == varType_i64) {
+					return evaluateInt64BinOp(n->operation, left->m_value_i64, right->m_value_i64);
+				}
+				if(left->isNumber() && right->isNumber()) {
+					return evaluateFloat32BinOp(n->operation, left->asFloat32(), right->asFloat32());
+				}
+				deoptimizeBinOp(n);
+				break;
+			case binOpForm_guardedStringConcat:
+				if(left->m_varType == varType_string && right->m_varType == varType_string) {
+					return newVariableString(StringRef::concat(left->m_value_string, right->m_value_string));
+				}
+				deoptimizeBinOp(n);
+				break;
+			case binOpForm_guardedStringEquals:
+				if(left->m_varType == varType_string && right->m_varType == varType_string) {
+					return newVariableBool(left->m_value_string == right->m_value_string);
+				}
+				deoptimizeBinOp(n);
+				break;
+			case binOpForm_generic:
+				recordBinOpFeedback(n, left, right);
+				break;
+		}
+
+		if(left->m_varType == varType_i64 && right->m_varType == varType_i64)
+		{
+			if(Var* const result = evaluateInt64BinOp(n->operation, left->m_value_i64, right->m_value_i64)) {
+				return result;
+			}
+		}
+
+		// Mixing integers with floats converts the integer.
+		if(left->isNumber() && right->isNumber())
+		{
+			if(Var* const result = evaluateFloat32BinOp(n->operation, left->asFloat32(), right->asFloat32())) {
+				return result;
+			}
+		}
+
+		if(left->m_varType == varType_string && right->m_varType == varType_string)
+		{
+			if(n->op == tokenType_equals) return newVariableBool(left->m_value_string == right->m_value_string);
+		}
+
+		if(left->m_varType == varType_string && n->op == tokenType_plus)
+		{
+			const StringRef& l = left->m_value_string;
+
+			// string + string
+			if(right->m_varType == varType_string) {
+				return newVariableString(StringRef::concat(l, right->m_value_string));
+			}
+			else if(right->m_varType == varType_f32) {
+				return newVariableString(StringRef::concat(l, numberToString(right->m_value_f32)));
+			}
+			else if(right->m_varType == varType_i64) {
+				return newVariableString(StringRef::concat(l, numberToString(right->m_value_i64)));
+			}
+		}
+		else if(right->m_varType == varType_string && n->op == tokenType_plus)
+		{
+			const StringRef& r = right->m_value_string;
+
+			// string + string
+			if(left->m_varType == varType_string) {
+				return newVariableString(StringRef::concat(left->m_value_string, r));
+			}
+			else if(left->m_varType == varType_f32) {
+				return newVariableString(StringRef::concat(numberToString(left->m_value_f32), r));
+			}
+			else if(left->m_varType == varType_i64) {
+				return newVariableString(StringRef::concat(numberToString(left->m_value_i64), r));
+			}
+		}
+		
+		// Unknown operation.
+		ThrowError(n->location, "Uknown/Unimplemented binary operation");
+		return nullptr;
+	}
+
+	Var* evaluateUnOp(const AstUnOp* const n, const Var* const left) {
+		if(!left->isNumber()) {
+			ThrowError(n->location, "Expected a number variable");
+		}
+
+		if(n->op == tokenType_not) {
+			return newVariableBool(!left->isTrue());
+		}
+
+		if(left->m_varType == varType_i64) {
+			const int64_t a = left->m_value_i64;
+			if(n->op == tokenType_plus) return newVariableInt64(a);
+			else if(n->op == tokenType_minus) return (a != INT64_MIN) ? newVariableInt64(-a) : newVariableFloat(-(float)a);
+			ThrowError(n->location, "Unknown unary operation!");
+		}
+
+		float v = 0.f;
+		if(n->op == tokenType_minus) v = -left->m_value_f32;
+		else if(n->op == tokenType_plus) v = left->m_value_f32;
+		else if(n->op == tokenType_not) v = left->m_value_f32 ? 0.f : 1.f;
+		else ThrowError(n->location, "Unknown unary operation!");
+
+		return newVariableFloat(v);
+	}
+
+	Var* evaluate(const AstNode* const root, EvalCtx& ctx)
+	{
+		if(ctx.forcedResult != nullptr) {
+			return ctx.forcedResult;
+		}
+
+		switch(root->type)
+		{
+			case astNodeType_number:
+			{   
+				const AstNumber* const n = (AstNumber*)root;
+				if(n->isInteger) {
+					return newVariableInt64(n->integerValue);
+				}
+				return newVariableFloat(n->value);
+			}break;
+			case astNodeType_string:
+			{   
+				return newVariableString(((AstString*)(root))->value); // string
+			}break;
+			case astNodeType_identifier:
+			{
+				return evaluateIdentifier((AstIdentifier*)root);
+			}break;
+			case astNodeType_fndecl:
+			{
+				const AstFnDecl* const n = (AstFnDecl*)root;
+				Var* const result = newVariableFunction(n);
+				return result;
+			}break;
+			case astNodeType_inlinedArgument:
+			{
+				return ctx.inlinedArguments[((AstInlinedArgument*)root)->index];
+			}break;
+			case astNodeType_memberAccess:
+			{
+				const AstMemberAcess* const n = (AstMemberAcess*)root;
+				return evaluateMemberAccess(n, evaluate(n->left, ctx));
+			}break;
+			case astNodeType_tableMaker:
+			{
+				const AstTableMaker* const n = (AstTableMaker*)root;
+				Var* result = newVariableTable(n->memberToExpression.size());
+				for(const auto& pair : n->memberToExpression)
 				{
-					if(n->op == tokenType_plus) return newVariableFloat(left->m_value_f32 + right->m_value_f32);
-					else if(n->op == tokenType_minus) return newVariableFloat(left->m_value_f32 - right->m_value_f32);
-					else if(n->op == tokenType_asterisk) return newVariableFloat(left->m_value_f32 * right->m_value_f32);
-					else if(n->op == tokenType_slash) return newVariableFloat(left->m_value_f32 / right->m_value_f32);
-					else if(n->op == tokenType_equals) return newVariableFloat(left->m_value_f32 == right->m_value_f32);
-					else if(n->op == tokenType_notEquals) return newVariableFloat(left->m_value_f32 != right->m_value_f32);
-					else if(n->op == tokenType_lessEquals) return newVariableFloat(left->m_value_f32 <= right->m_value_f32);
-					else if(n->op == tokenType_greaterEquals) return newVariableFloat(left->m_value_f32 >= right->m_value_f32);
-					else if(n->op == tokenType_less) return newVariableFloat(left->m_value_f32 < right->m_value_f32);
-					else if(n->op == tokenType_greater) return newVariableFloat(left->m_value_f32 > right->m_value_f32);
-				}
-
-				if(left->m_varType == varType_string && right->m_varType == varType_string)
+					*result->m_table->findOrInsert(pair.first) = *evaluate(pair.second, ctx);
+				}
+
+				return result;
+			}break;
+			case astNodeType_arrayMaker:
+			{
+				const AstArrayMaker* const n = (AstArrayMaker*)root;
+				Var* result = newVariableRaw(nullptr, varType_array);
+				result->m_array->reserve(n->arrayElements.size());
+				for(const AstNode* const expr : n->arrayElements)
 				{
-					if(n->op == tokenType_equals) return newVariableFloat(left->m_value_string == right->m_value_string);
+					result->m_array->pushBack(*evaluate(expr, ctx));
+				}
+				m_heap.noteAllocation(n->arrayElements.size() * sizeof(Var));
+
+				return result;
+			}break;
+			case astNodeType_binop:
+			{
+				const AstBinOp* const n = (AstBinOp*)root;
+				const Var* const left = evaluate(n->left, ctx);
+				const Var* const right = evaluate(n->right, ctx);
+				return evaluateBinOp(n, left, right);
+			}break;
+			case astNodeType_unop:
+			{
+				const AstUnOp* const n = (AstUnOp*)root;
+				return evaluateUnOp(n, evaluate(n->left, ctx));
+			}break;
+			case astNodeType_assign:
+			{
+				const AstAssign* const n = (AstAssign*)root;
+
+				// x = x + <integer>, done in place.
+				if(n->isIncrement) {
+					Var* const left = evaluate(n->left, ctx);
+					int64_t result = 0;
+					if(left->m_varType == varType_i64 && checkedAdd(left->m_value_i64, n->incrementStep, result)) {
+						left->m_value_i64 = result;
+						return left;
+					}
+
+					const Var* const right = evaluate(n->right, ctx);
+					assignVar(left, *right);
+					return left;
+				}
+
+				// Writing to an array element must not be visible in the other arrays that share the buffer,
+				// so the element is obtained for writing after the right side is evaluated (it might slice the array).
+				if(n->left->type == astNodeType_arrayIndexing) {
+					const AstArrayIndexing* const indexing = (AstArrayIndexing*)n->left;
+					size_t idx = 0;
+					Array* const array = evaluateIndexedArray(indexing, ctx, idx);
+					const Var* const right = evaluate(n->right, ctx);
+					if(idx >= array->size()) {
+						ThrowError(indexing->location, "Out of bounds array indexing");
+					}
+					Var* const left = array->elementForWrite(idx);
+					assignVar(left, *right);
+					return left;
+				}
+
+				Var* const left = evaluate(n->left, ctx);
+				const Var* const right = evaluate(n->right, ctx);
+				assignVar(left, *right);
+				return left;
+			}break;
+			case astNodeType_fnCall:
+			{
+				const AstFnCall* const n = (AstFnCall*)root;
+
+				Var* const fn = evaluate(n->theFunction, ctx);
+
+				const AstFnDecl* const fnDecl = resolveCallSite(n, fn);
+				if(fnDecl && n->inlinedBody) {
+					return evaluateInlinedCall(n, ctx);
+				}
+
+				// Evaluate the argument values.
+				std::vector<Var*> arguments;
+				arguments.reserve(n->callArgs.size());
+				for(AstNode* argExpression : n->callArgs) {
+					arguments.push_back(evaluate(argExpression, ctx));
+				}
+
+				if(fnDecl) {
+					return callScriptFunction(fnDecl, (int)arguments.size(), arguments.data());
+				}
+
+				return callFunction(fn, (int)arguments.size(), arguments.data(), n->location);
+			}break;
+			case astNodeType_arrayIndexing:
+			{
+				const AstArrayIndexing* const n = (AstArrayIndexing*)root;
+				size_t idx = 0;
+				Array* const array = evaluateIndexedArray(n, ctx, idx);
+				return array->elementForRead(idx);
+			}break;
+			case astNodeType_statementList:
+			{
+				const AstStatementList* const n = (AstStatementList*)root;
+
+				if(n->needsOwnScope) {
+					pushScope(n, nullptr);
+				}
+
+				// The temporaries of each statement are released when the next one starts,
+				// the ones of the last statement are kept as they might be the result of the list.
+				const size_t tempRootsWatermark = m_tempRoots.size();
+
+				Var* result = nullptr;
+				for(AstNode* node : n->m_statements) {
+					if(ctx.forcedResult) {
+						result = ctx.forcedResult;
+						break;
+					}
+
+					releaseTempRoots(tempRootsWatermark);
+					gcSafePoint(node->location);
+					result = evaluate(node, ctx);
+				}
+
+				if(n->needsOwnScope) {
+					popScope();
+				}
+
+				return result;
+			}break;
+			case astNodeType_if:
+			{
+				const AstIf* const n = (AstIf*)root;
+
+				if(evaluateCondition(n->expression, ctx)) {
+					pushScope(n, "true");
+					Var* const expr = evaluate(n->trueBranchStatement, ctx);
+					popScope();
+					return expr;
+				}
+				else if(n->falseBranchStatement) {
+					pushScope(n, "false");
+					Var* const expr = evaluate(n->falseBranchStatement, ctx);
+					popScope();
+					return expr;
+				}
+
+				return nullptr;
+			}break;
+			case astNodeType_while:
+			{
+				const AstWhile* const n = (AstWhile*)root;
+
+				pushScope(n, nullptr);
+				const size_t tempRootsWatermark = m_tempRoots.size();
+				while(true) {
+					releaseTempRoots(tempRootsWatermark);
+					gcSafePoint(n->location);
+					burnFuel(n->location);
+
+					const bool shouldContinue = evaluateCondition(n->expression, ctx);
+					if(ctx.forcedResult || !shouldContinue) {
+						break;
+					}
+
+					evaluate(n->trueBranchStatement, ctx);
+					if(ctx.forcedResult) {
+						break;
+					}
+				}
+				popScope();
+	
+				return nullptr;
+			}break;
+			case astNodeType_for:
+			{
+				const AstFor* const n = (AstFor*)root;
+				pushScope(n, nullptr);
+				evaluate(n->initExpression, ctx);
+
+				// For counted loops, the counter and the bound are named variables (or a literal), so the pointers stay valid for the whole loop.
+				Var* counter = nullptr;
+				const Var* bound = nullptr;
+				Var boundLiteral;
+				if(n->counter) {
+					counter = evaluate(n->counter, ctx);
+					if(n->bound->type == astNodeType_number) {
+						boundLiteral.makeInt64(((AstNumber*)n->bound)->integerValue);
+						bound = &boundLiteral;
+					} else {
+						bound = evaluate(n->bound, ctx);
+					}
+				}
+
+				const size_t tempRootsWatermark = m_tempRoots.size();
+				while(true) {
+					releaseTempRoots(tempRootsWatermark);
+					gcSafePoint(n->location);
+					burnFuel(n->location);
+
+					bool shouldContinue = false;
+					if(counter && counter->m_varType == varType_i64 && bound->m_varType == varType_i64) {
+						shouldContinue = compareValues(n->counterComparison, counter->m_value_i64, bound->m_value_i64);
+					} else {
+						shouldContinue = evaluateCondition(n->expression, ctx);
+					}
+
+					if(ctx.forcedResult || !shouldContinue) {
+						break;
+					}
+
+					evaluate(n->trueBranchStatement, ctx);
+					if(ctx.forcedResult) {
+						break;
+					}
+
+					int64_t nextCount = 0;
+					if(counter && counter->m_varType == varType_i64
+						&& checkedAdd(counter->m_value_i64, ((AstAssign*)n->postIterationExpression)->incrementStep, nextCount)) {
+						counter->m_value_i64 = nextCount;
+					} else {
+						evaluate(n->postIterationExpression, ctx);
+					}
+				}
+				popScope();
+
+				return nullptr;
+			}break;
+			case astNodeType_return:
+			{
+				const AstReturn* const n = (AstReturn*)root;
+				if (n->expression!=nullptr) {
+					// The value is copied to a new temporary, as the returned variable might not outlive the function call.
+					const Var* const value = evaluate(n->expression, ctx);
+					if(value) {
+						ctx.forcedResult = newVariableCopy(*value);
+					}
+				} else {
+					ctx.forcedResult = nullptr;
+				}
+				return ctx.forcedResult;
+			}break;
+			case astNodeType_print:
+			{
+				const AstPrint* const n = (AstPrint*)root;
+				const Var* const expr = evaluate(n->expression, ctx);
+
+				printVariable(m_output, expr);
+
+				return nullptr;
+			}break;
+		}
+
+		ThrowError(root->location, "Uknown AST operation");
+		return nullptr;
+	}
+
+private :
+
+	void addStnadardLibFunctions() {
+
+		NativeFnPtr const array_size = [](int argc, Var* argv[], Executor* exec, Var** ppResultVariable) -> int {
+			if(argc != 1 || argv[0] == nullptr|| argv[0]->m_varType != varType_array) {
+				return 0;
+			}
+
+			int64_t size = 0;
+			if(argv[0]->m_array) {
+				size = argv[0]->m_array->size();
+			}else{
+				ThrowError(Location(), "Internal Error: Uninitialized array");
+			}
+
+			*ppResultVariable = exec->newVariableInt64(size);
+			return 1;
+		};
+
+		newVariableNativeFunction("array_size", array_size);
+	
+		// array_pop(arr) removes the last element, array_pop(arr, index) the element at index. Returns the removed element.
+		NativeFnPtr const array_pop = [](int argc, Var* argv[], Executor* exec, Var** ppResultVariable) -> int {
+			if(argv[0] == nullptr|| argv[0]->m_varType != varType_array)
+				return 0;
+
+			Array* const array = argv[0]->m_array;
+			if(array == nullptr) {
+				ThrowError(Location(), "Internal Error: Uninitialized array");
+			}
+
+			*ppResultVariable = exec->newVariableRaw(nullptr, varType_undefined);
+			
+			if(argc == 1)
+			{
+				if(array->size() != 0) {
+					exec->m_heap.writeBarrier(array->at(array->size() - 1));
+					**ppResultVariable = array->popBack();
+				}
+			}
+			else if(argc == 2)
+			{
+				int64_t idx = 0;
+				if(!getIntegerArgument(argv[1], idx)) {
+					return 0;
+				}
+
+				if(idx < 0 || idx >= (int64_t)array->size()) {
+					return 0;
+				}
+
+				exec->m_heap.writeBarrier(array->at(idx));
+				**ppResultVariable = array->erase(idx);
+			}
+			else {
+				return 0;
+			}
+
+			return 1;
+		};
+	
+		newVariableNativeFunction("array_pop", array_pop);
+
+		NativeFnPtr const array_push = [](int argc, Var* argv[], Executor* exec, Var** ppResultVariable) -> int {
+			if(argc != 2 || argv[0] == nullptr|| argv[0]->m_varType != varType_array) {
+				return 0;
+			}
+
+			if(argv[0]->m_array) {
+				argv[0]->m_array->pushBack(*argv[1]);
+				exec->m_heap.noteAllocation(sizeof(Var));
+			}else{
+				ThrowError(Location(), "Internal Error: Uninitialized array");
+			}
+
+			return 1;
+		};
+
+		newVariableNativeFunction("array_push", array_push);
+
+		// array_push_front(arr, value) inserts the value before the first element in O(1).
+		NativeFnPtr const array_push_front = [](int argc, Var* argv[], Executor* exec, Var** ppResultVariable) -> int {
+			if(argc != 2 || argv[0] == nullptr|| argv[0]->m_varType != varType_array || !argv[0]->m_array) {
+				return 0;
+			}
+
+			argv[0]->m_array->pushFront(*argv[1]);
+			exec->m_heap.noteAllocation(sizeof(Var));
+			return 1;
+		};
+
+		newVariableNativeFunction("array_push_front", array_push_front);
+
+		// array_pop_front(arr) removes the first element in O(1) and returns it.
+		NativeFnPtr const array_pop_front = [](int argc, Var* argv[], Executor* exec, Var** ppResultVariable) -> int {
+			if(argc != 1 || argv[0] == nullptr|| argv[0]->m_varType != varType_array || !argv[0]->m_array) {
+				return 0;
+			}
+
+			Array* const array = argv[0]->m_array;
+			*ppResultVariable = exec->newVariableRaw(nullptr, varType_undefined);
+			if(array->size() != 0) {
+				exec->m_heap.writeBarrier(array->at(0));
+				**ppResultVariable = array->popFront();
+			}
+			return 1;
+		};
+
+		newVariableNativeFunction("array_pop_front", array_pop_front);
+
+		// array_slice(arr, from, to) returns a new array with the elements [from, to). If to is omitted, the slice goes until the end.
+		// The slice shares the elements with the original array until one of them is modified.
+		NativeFnPtr const array_slice = [](int argc, Var* argv[], Executor* exec, Var** ppResultVariable) -> int {
+			if(argc < 2 || argc > 3 || argv[0] == nullptr|| argv[0]->m_varType != varType_array || !argv[0]->m_array) {
+				return 0;
+			}
+
+			Array* const array = argv[0]->m_array;
+			int64_t from = 0;
+			int64_t to = array->size();
+			if(!getIntegerArgument(argv[1], from) || (argc == 3 && !getIntegerArgument(argv[2], to))) {
+				return 0;
+			}
+
+			if(from < 0 || from > to || to > (int64_t)array->size()) {
+				return 0;
+			}
+
+			*ppResultVariable = exec->newVariableRaw(nullptr, varType_array);
+			(*ppResultVariable)->m_array->shareRange(*array, from, to);
+			return 1;
+		};
+
+		newVariableNativeFunction("array_slice", array_slice);
+
+		// array_sort(arr) sorts an array of numbers or an array of strings in ascending order.
+		// array_sort(arr, less) sorts any array, less(a, b) must return non-zero if a goes before b. The sort is stable.
+		NativeFnPtr const array_sort = [](int argc, Var* argv[], Executor* exec, Var** ppResultVariable) -> int {
+			if(argc < 1 || argc > 2 || argv[0] == nullptr|| argv[0]->m_varType != varType_array || !argv[0]->m_array) {
+				return 0;
+			}
+
+			Array* const array = argv[0]->m_array;
+			const size_t count = array->size();
+
+			if(argc == 2) {
+				// Sort the indices of the elements, so the elements stay in the array while the comparator runs.
+				std::vector<uint32_t> order(count);
+				std::vector<uint32_t> merged(count);
+				for(uint32_t t = 0; t < count; ++t) order[t] = t;
+
+				const TempRoot arrayRoot(exec, *argv[0]);
+				const size_t tempRootsWatermark = exec->m_tempRoots.size();
+				const auto isLess = [&](const uint32_t a, const uint32_t b) -> bool {
+					Var* args[2] = { array->elementForRead(a), array->elementForRead(b) };
+					const bool result = exec->callFunction(argv[1], 2, args, Location())->isTrue();
+					exec->releaseTempRoots(tempRootsWatermark);
+					if(array->size() != count) {
+						ThrowError(Location(), "An array was modified while being sorted");
+					}
+					return result;
+				};
+
+				// A bottom-up merge sort rather than std::stable_sort, the comparator is script code and may not be a strict weak ordering.
+				// Each merge only moves indices within its own runs, so any comparator results in a permutation of the indices.
+				for(size_t width = 1; width < count; width *= 2) {
+					for(size_t lo = 0; lo < count; lo += 2 * width) {
+						const size_t mid = std::min(lo + width, count);
+						const size_t hi = std::min(lo + 2 * width, count);
+						size_t left = lo, right = mid, out = lo;
+						while(left < mid && right < hi) {
+							merged[out++] = isLess(order[right], order[left]) ? order[right++] : order[left++];
+						}
+						while(left < mid) merged[out++] = order[left++];
+						while(right < hi) merged[out++] = order[right++];
+					}
+					order.swap(merged);
+				}
+
+				// The elements are only reordered, so the garbage collector does not need to know about it.
+				std::vector<Var> sorted;
+				sorted.reserve(count);
+				for(const uint32_t idx : order) sorted.push_back(array->at(idx));
+				for(size_t t = 0; t < count; ++t) *array->elementForWrite(t) = std::move(sorted[t]);
+				return 1;
+			}
+
+			bool areAllIntegers = true;
+			bool areAllFloats = true;
+			bool areAllNumbers = true;
+			bool areAllStrings = true;
+			array->forEach([&](const Var& var) {
+				areAllIntegers &= var.m_varType == varType_i64;
+				areAllFloats &= var.m_varType == varType_f32;
+				areAllNumbers &= var.isNumber();
+				areAllStrings &= var.m_varType == varType_string;
+			});
+
+			// Large arrays are sorted on multiple threads.
+			const size_t kMinElementsPerThread = 1 << 16;
+			const size_t numThreads = std::min<size_t>(std::thread::hardware_concurrency(), count / kMinElementsPerThread);
+
+			if(areAllIntegers) {
+				std::vector<int64_t> numbers;
+				numbers.reserve(count);
+				array->forEach([&numbers](const Var& var) { numbers.push_back(var.m_value_i64); });
+
+				if(numThreads > 1) {
+					parallelSort(numbers.data(), count, numThreads, std::less<int64_t>());
+				} else {
+					std::sort(numbers.begin(), numbers.end());
+				}
+
+				for(size_t t = 0; t < count; ++t) array->elementForWrite(t)->m_value_i64 = numbers[t];
+			}
+			else if(areAllFloats) {
+				std::vector<float> numbers;
+				numbers.reserve(count);
+				array->forEach([&numbers](const Var& var) { numbers.push_back(var.m_value_f32); });
+
+				if(numThreads > 1) {
+					parallelSort(numbers.data(), count, numThreads, isFloatLess);
+				} else {
+					std::sort(numbers.begin(), numbers.end(), isFloatLess);
+				}
+
+				for(size_t t = 0; t < count; ++t) array->elementForWrite(t)->m_value_f32 = numbers[t];
+			}
+			else if(areAllNumbers) {
+				// Integers mixed with floats, the elements keep their types.
+				std::vector<Var> numbers;
+				numbers.reserve(count);
+				array->forEach([&numbers](const Var& var) { numbers.push_back(var); });
+
+				std::stable_sort(numbers.begin(), numbers.end(), [](const Var& a, const Var& b) -> bool {
+					return isFloatLess(a.asFloat32(), b.asFloat32());
+				});
+
+				for(size_t t = 0; t < count; ++t) *array->elementForWrite(t) = std::move(numbers[t]);
+			}
+			else if(areAllStrings) {
+				std::vector<StringRef> strings;
+				strings.reserve(count);
+				array->forEach([&strings](const Var& var) { strings.push_back(var.m_value_string); });
+
+				std::sort(strings.begin(), strings.end(), [](const StringRef& a, const StringRef& b) -> bool {
+					return a.view() < b.view();
+				});
+
+				for(size_t t = 0; t < count; ++t) array->elementForWrite(t)->m_value_string = std::move(strings[t]);
+			}
+			else {
+				return 0;
+			}
+
+			return 1;
+		};
+
+		newVariableNativeFunction("array_sort", array_sort);
+
+		// array_map(arr, fn) returns a new array with the results of fn(element) for each element.
+		NativeFnPtr const array_map = [](int argc, Var* argv[], Executor* exec, Var** ppResultVariable) -> int {
+			if(argc != 2 || argv[0] == nullptr|| argv[0]->m_varType != varType_array || !argv[0]->m_array) {
+				return 0;
+			}
+
+			Array* const array = argv[0]->m_array;
+			Var* const result = exec->newVariableRaw(nullptr, varType_array);
+			exec->m_heap.noteAllocation(array->size() * sizeof(Var));
+			result->m_array->reserve(array->size());
+
+			const TempRoot arrayRoot(exec, *argv[0]);
+			const size_t tempRootsWatermark = exec->m_tempRoots.size();
+			for(size_t t = 0; t < array->size(); ++t) {
+				Var* args[1] = { array->elementForRead(t) };
+				result->m_array->pushBack(*exec->callFunction(argv[1], 1, args, Location()));
+				exec->releaseTempRoots(tempRootsWatermark);
+			}
+
+			*ppResultVariable = result;
+			return 1;
+		};
+
+		newVariableNativeFunction("array_map", array_map);
+
+		// array_filter(arr, fn) returns a new array with the elements for which fn(element) returned non-zero.
+		NativeFnPtr const array_filter = [](int argc, Var* argv[], Executor* exec, Var** ppResultVariable) -> int {
+			if(argc != 2 || argv[0] == nullptr|| argv[0]->m_varType != varType_array || !argv[0]->m_array) {
+				return 0;
+			}
+
+			Array* const array = argv[0]->m_array;
+			Var* const result = exec->newVariableRaw(nullptr, varType_array);
+
+			const TempRoot arrayRoot(exec, *argv[0]);
+			const size_t tempRootsWatermark = exec->m_tempRoots.size();
+			for(size_t t = 0; t < array->size(); ++t) {
+				Var* args[1] = { array->elementForRead(t) };
+				const bool isKept = exec->callFunction(argv[1], 1, args, Location())->isTrue();
+				exec->releaseTempRoots(tempRootsWatermark);
+				if(isKept && t < array->size()) {
+					result->m_array->pushBack(array->at(t));
+					exec->m_heap.noteAllocation(sizeof(Var));
+				}
+			}
+
+			*ppResultVariable = result;
+			return 1;
+		};
+
+		newVariableNativeFunction("array_filter", array_filter);
+
+		// array_reduce(arr, fn, initial) folds the array from the left, the accumulator becomes fn(accumulator, element).
+		NativeFnPtr const array_reduce = [](int argc, Var* argv[], Executor* exec, Var** ppResultVariable) -> int {
+			if(argc != 3 || argv[0] == nullptr|| argv[0]->m_varType != varType_array || !argv[0]->m_array) {
+				return 0;
+			}
+
+			Array* const array = argv[0]->m_array;
+			Var* const accumulator = exec->newVariableRaw(nullptr, varType_undefined);
+			exec->assignVar(accumulator, *argv[2]);
+
+			const TempRoot arrayRoot(exec, *argv[0]);
+			const size_t tempRootsWatermark = exec->m_tempRoots.size();
+			for(size_t t = 0; t < array->size(); ++t) {
+				Var* args[2] = { accumulator, array->elementForRead(t) };
+				exec->assignVar(accumulator, *exec->callFunction(argv[1], 2, args, Location()));
+				exec->releaseTempRoots(tempRootsWatermark);
+			}
+
+			*ppResultVariable = accumulator;
+			return 1;
+		};
+
+		newVariableNativeFunction("array_reduce", array_reduce);
+
+		// array_index_of(arr, value) returns the index of the first element equal to value, or -1.
+		NativeFnPtr const array_index_of = [](int argc, Var* argv[], Executor* exec, Var** ppResultVariable) -> int {
+			if(argc != 2 || argv[0] == nullptr|| argv[0]->m_varType != varType_array || !argv[0]->m_array) {
+				return 0;
+			}
+
+			const Array* const array = argv[0]->m_array;
+			const Var& value = *argv[1];
+			int64_t index = -1;
+			for(size_t t = 0; t < array->size(); ++t) {
+				if(areValuesEqual(array->at(t), value)) {
+					index = t;
+					break;
+				}
+			}
+
+			*ppResultVariable = exec->newVariableInt64(index);
+			return 1;
+		};
+
+		newVariableNativeFunction("array_index_of", array_index_of);
+
+		// array_find(arr, fn) returns the index of the first element for which fn(element) returned non-zero, or -1.
+		NativeFnPtr const array_find = [](int argc, Var* argv[], Executor* exec, Var** ppResultVariable) -> int {
+			if(argc != 2 || argv[0] == nullptr|| argv[0]->m_varType != varType_array || !argv[0]->m_array) {
+				return 0;
+			}
+
+			Array* const array = argv[0]->m_array;
+			int64_t index = -1;
+			{
+				const TempRoot arrayRoot(exec, *argv[0]);
+				const size_t tempRootsWatermark = exec->m_tempRoots.size();
+				for(size_t t = 0; t < array->size(); ++t) {
+					Var* args[1] = { array->elementForRead(t) };
+					const bool isFound = exec->callFunction(argv[1], 1, args, Location())->isTrue();
+					exec->releaseTempRoots(tempRootsWatermark);
+					if(isFound) {
+						index = t;
+						break;
+					}
+				}
+			}
+
+			*ppResultVariable = exec->newVariableInt64(index);
+			return 1;
+		};
+
+		newVariableNativeFunction("array_find", array_find);
+
+		NativeFnPtr const string_size = [](int argc, Var* argv[], Executor* exec, Var** ppResultVariable) -> int {
+			if(argc != 1 || argv[0] == nullptr || argv[0]->m_varType != varType_string) {
+				return 0;
+			}
+
+			*ppResultVariable = exec->newVariableInt64(argv[0]->m_value_string.size());
+			return 1;
+		};
+
+		newVariableNativeFunction("string_size", string_size);
+
+		// string_substring(str, from, to) returns the characters [from, to). If to is omitted, the substring goes until the end.
+		// The result references the characters of str, they are not copied.
+		NativeFnPtr const string_substring = [](int argc, Var* argv[], Executor* exec, Var** ppResultVariable) -> int {
+			if(argc < 2 || argc > 3 || argv[0] == nullptr || argv[0]->m_varType != varType_string) {
+				return 0;
+			}
+
+			const StringRef& str = argv[0]->m_value_string;
+			int64_t from = 0;
+			int64_t to = str.size();
+			if(!getIntegerArgument(argv[1], from) || (argc == 3 && !getIntegerArgument(argv[2], to))) {
+				return 0;
+			}
+
+			if(from < 0 || from > to || to > (int64_t)str.size()) {
+				return 0;
+			}
+
+			*ppResultVariable = exec->newVariableString(str.substring(from, to - from));
+			return 1;
+		};
+
+		newVariableNativeFunction("string_substring", string_substring);
+
+		// string_find(str, what, from) returns the position of the first occurrence of what at or after from (0 if omitted), or -1.
+		NativeFnPtr const string_find = [](int argc, Var* argv[], Executor* exec, Var** ppResultVariable) -> int {
+			if(argc < 2 || argc > 3 || argv[0] == nullptr || argv[0]->m_varType != varType_string || argv[1] == nullptr || argv[1]->m_varType != varType_string) {
+				return 0;
+			}
+
+			int64_t from = 0;
+			if(argc == 3 && (!getIntegerArgument(argv[2], from) || from < 0)) {
+				return 0;
+			}
+
+			const size_t found = findInString(argv[0]->m_value_string.view(), argv[1]->m_value_string.view(), from);
+			*ppResultVariable = exec->newVariableInt64(found == std::string_view::npos ? -1 : (int64_t)found);
+			return 1;
+		};
+
+		newVariableNativeFunction("string_find", string_find);
+
+		// string_split(str, separator) returns an array of the parts of str between the separators.
+		// The parts reference the characters of str, they are not copied.
+		NativeFnPtr const string_split = [](int argc, Var* argv[], Executor* exec, Var** ppResultVariable) -> int {
+			if(argc != 2 || argv[0] == nullptr || argv[0]->m_varType != varType_string || argv[1] == nullptr || argv[1]->m_varType != varType_string) {
+				return 0;
+			}
+
+			const StringRef& str = argv[0]->m_value_string;
+			const std::string_view separator = argv[1]->m_value_string.view();
+			if(separator.empty()) {
+				return 0;
+			}
+
+			Var* const result = exec->newVariableRaw(nullptr, varType_array);
+			Var part;
+			size_t partBegin = 0;
+			while(true) {
+				const size_t found = findInString(str.view(), separator, partBegin);
+				const size_t partEnd = (found == std::string_view::npos) ? str.size() : found;
+
+				part.makeString(str.substring(partBegin, partEnd - partBegin));
+				result->m_array->pushBack(part);
+				exec->m_heap.noteAllocation(sizeof(Var) + Heap::stringBytes(part));
+
+				if(found == std::string_view::npos) {
+					break;
+				}
+				partBegin = found + separator.size();
+			}
+
+			*ppResultVariable = result;
+			return 1;
+		};
+
+		newVariableNativeFunction("string_split", string_split);
+
+		NativeFnPtr const string_starts_with = [](int argc, Var* argv[], Executor* exec, Var** ppResultVariable) -> int {
+			if(argc != 2 || argv[0] == nullptr || argv[0]->m_varType != varType_string || argv[1] == nullptr || argv[1]->m_varType != varType_string) {
+				return 0;
+			}
+
+			const std::string_view str = argv[0]->m_value_string.view();
+			const std::string_view prefix = argv[1]->m_value_string.view();
+			const bool startsWith = str.size() >= prefix.size() && memcmp(str.data(), prefix.data(), prefix.size()) == 0;
+			*ppResultVariable = exec->newVariableBool(startsWith);
+			return 1;
+		};
+
+		newVariableNativeFunction("string_starts_with", string_starts_with);
+
+		// json_load(path) reads a JSON file, objects become tables (see JsonReader).
+		NativeFnPtr const json_load = [](int argc, Var* argv[], Executor* exec, Var** ppResultVariable) -> int {
+			if(argc != 1 || argv[0] == nullptr || argv[0]->m_varType != varType_string) {
+				return 0;
+			}
+
+			const char* const path = argv[0]->m_value_string.c_str();
+			MappedFile file;
+			if(!file.open(path)) {
+				ThrowError(Location(), std::string("Could not read the file ") + path);
+			}
+
+			*ppResultVariable = exec->newVariableRaw(nullptr, varType_undefined);
+			std::string error;
+			if(!JsonReader(exec->m_heap).read(file.data(), file.size(), **ppResultVariable, error)) {
+				ThrowError(Location(), std::string("Could not load the JSON file ") + path + ", " + error);
+			}
+			return 1;
+		};
+
+		newVariableNativeFunction("json_load", json_load);
+
+		// json_parse(str) is json_load for JSON that is already in a string.
+		NativeFnPtr const json_parse = [](int argc, Var* argv[], Executor* exec, Var** ppResultVariable) -> int {
+			if(argc != 1 || argv[0] == nullptr || argv[0]->m_varType != varType_string) {
+				return 0;
+			}
+
+			const StringRef json = argv[0]->m_value_string;
+			*ppResultVariable = exec->newVariableRaw(nullptr, varType_undefined);
+			std::string error;
+			if(!JsonReader(exec->m_heap).read(json.data(), json.size(), **ppResultVariable, error)) {
+				ThrowError(Location(), "Could not parse the JSON, " + error);
+			}
+			return 1;
+		};
+
+		newVariableNativeFunction("json_parse", json_parse);
+
+		// value_save(path, value) writes a value (and everything reachable from it) to a file in the binary format of the snapshots,
+		// value_load(path) reads it back. Loading it is much faster than loading the same data as JSON.
+		NativeFnPtr const value_save = [](int argc, Var* argv[], Executor* exec, Var** ppResultVariable) -> int {
+			if(argc != 2 || argv[0] == nullptr || argv[0]->m_varType != varType_string || argv[1] == nullptr) {
+				return 0;
+			}
+
+			const char* const path = argv[0]->m_value_string.c_str();
+			ValueWriter writer(exec->m_nativeFunctions);
+			writer.addRoot(std::string_view(), *argv[1]);
+			std::string error;
+			if(!writer.write(0, path, error)) {
+				ThrowError(Location(), std::string("Could not save the value to ") + path + ", " + error);
+			}
+			return 1;
+		};
+
+		newVariableNativeFunction("value_save", value_save);
+
+		NativeFnPtr const value_load = [](int argc, Var* argv[], Executor* exec, Var** ppResultVariable) -> int {
+			if(argc != 1 || argv[0] == nullptr || argv[0]->m_varType != varType_string) {
+				return 0;
+			}
+
+			const char* const path = argv[0]->m_value_string.c_str();
+			MappedFile file;
+			if(!file.open(path)) {
+				ThrowError(Location(), std::string("Could not read the file ") + path);
+			}
+
+			ValueReader reader(exec->m_heap, nullptr, exec->m_nativeFunctions);
+			std::string error;
+			if(!reader.read(file.data(), file.size(), 0, error)) {
+				ThrowError(Location(), std::string("Could not load the value from ") + path + ", " + error);
+			}
+			if(reader.roots.size() != 1) {
+				ThrowError(Location(), std::string("Could not load the value from ") + path + ", it doesn't hold a single value");
+			}
+
+			*ppResultVariable = exec->newVariableRaw(nullptr, varType_undefined);
+			**ppResultVariable = std::move(reader.roots[0].second);
+			return 1;
+		};
+
+		newVariableNativeFunction("value_load", value_load);
+
+		// channel_open(name) and channel_open(name, capacity) return the id of the channel with that name, creating it if needed
+		// (with room for 64 values by default). The Executors that share a group of channels get the same channel for the same name.
+		NativeFnPtr const channel_open = [](int argc, Var* argv[], Executor* exec, Var** ppResultVariable) -> int {
+			int64_t capacity = 64;
+			if(argc < 1 || argc > 2 || argv[0] == nullptr || argv[0]->m_varType != varType_string || (argc == 2 && !getIntegerArgument(argv[1], capacity)) || capacity < 1) {
+				return 0;
+			}
+
+			const int64_t id = exec->channels().open(std::string(argv[0]->m_value_string.view()), (size_t)capacity);
+			if(id < 0) {
+				ThrowError(Location(), "Too many channels");
+			}
+			*ppResultVariable = exec->newVariableRaw(nullptr, varType_i64);
+			(*ppResultVariable)->m_value_i64 = id;
+			return 1;
+		};
+
+		newVariableNativeFunction("channel_open", channel_open);
+
+		// channel_send(ch, value) moves the value to the channel, waiting while the channel is full. The tables and arrays in the value
+		// are emptied, the receiver gets their contents. Waiting burns fuel.
+		NativeFnPtr const channel_send = [](int argc, Var* argv[], Executor* exec, Var** ppResultVariable) -> int {
+			int64_t id = 0;
+			if(argc != 2 || !getIntegerArgument(argv[0], id) || argv[1] == nullptr) {
+				return 0;
+			}
+
+			const ChannelGroup& group = exec->channels();
+			Channel* const channel = group.find(id);
+			if(channel == nullptr) {
+				return 0;
+			}
+			if(containsScriptFunction(*argv[1])) {
+				ThrowError(Location(), "Functions of the script can't be sent to a channel");
+			}
+
+			const bool isSent = channel->send(exec->m_heap.detachGraph(*argv[1]), [exec, &group]() {
+				if(group.isShared == false) {
+					ThrowError(Location(), "The channel is full and no other script receives from it");
+				}
+				exec->burnFuel(Location());
+			});
+			if(!isSent) {
+				ThrowError(Location(), "The channel is closed");
+			}
+			return 1;
+		};
+
+		newVariableNativeFunction("channel_send", channel_send);
+
+		// channel_receive(ch) waits for a value, it returns undefined once the channel is closed and empty (see is_undefined).
+		// Waiting burns fuel.
+		NativeFnPtr const channel_receive = [](int argc, Var* argv[], Executor* exec, Var** ppResultVariable) -> int {
+			int64_t id = 0;
+			if(argc != 1 || !getIntegerArgument(argv[0], id)) {
+				return 0;
+			}
+
+			const ChannelGroup& group = exec->channels();
+			Channel* const channel = group.find(id);
+			if(channel == nullptr) {
+				return 0;
+			}
+
+			*ppResultVariable = exec->newVariableRaw(nullptr, varType_undefined);
+			HeapTransfer transfer;
+			const bool isReceived = channel->receive(transfer, [exec, &group]() {
+				if(group.isShared == false) {
+					ThrowError(Location(), "The channel is empty and no other script sends to it");
+				}
+				exec->burnFuel(Location());
+			});
+			if(isReceived) {
+				**ppResultVariable = exec->m_heap.adoptGraph(std::move(transfer));
+			}
+			return 1;
+		};
+
+		newVariableNativeFunction("channel_receive", channel_receive);
+
+		// channel_close(ch) tells the receivers that nothing else will be sent.
+		NativeFnPtr const channel_close = [](int argc, Var* argv[], Executor* exec, Var** ppResultVariable) -> int {
+			int64_t id = 0;
+			if(argc != 1 || !getIntegerArgument(argv[0], id)) {
+				return 0;
+			}
+
+			Channel* const channel = exec->channels().find(id);
+			if(channel == nullptr) {
+				return 0;
+			}
+			channel->close();
+			return 1;
+		};
+
+		newVariableNativeFunction("channel_close", channel_close);
+
+		// is_undefined(value) returns 1 for undefined values (like the end of a channel, a missing member or a JSON null), as they can't be compared.
+		NativeFnPtr const is_undefined = [](int argc, Var* argv[], Executor* exec, Var** ppResultVariable) -> int {
+			if(argc != 1) {
+				return 0;
+			}
+
+			*ppResultVariable = exec->newVariableBool(argv[0] == nullptr || argv[0]->m_varType == varType_undefined);
+			return 1;
+		};
+
+		newVariableNativeFunction("is_undefined", is_undefined);
+	}
+	
+public :
+
+	std::unordered_map<std::string, Var*> m_variablesLut;
+	std::vector<std::string> m_scopeStack;
+	int m_callDepth = 0; // The script functions that are running (see kMaxCallDepth).
+
+	// The global variables and builtins indexed by the symbol of their name (see Symbols).
+	std::vector<GlobalSlot> m_globalSlots;
+
+	// Every native function registered with newVariableNativeFunction.
+	std::vector<NativeFunction> m_nativeFunctions;
+
+	OutputSink m_output; // Where print statements write to, the host could redirect it.
+
+	// Owns every variable, table and array. The roots of the garbage collector are the named variables in m_variablesLut
+	// and the temporaries in m_tempRoots.
+	Heap m_heap;
+
+	// The work that the script could still do before m_fuelExhaustedFn is called (see setFuel), unlimited by default.
+	int64_t m_fuel = INT64_MAX;
+	FuelExhaustedFn m_fuelExhaustedFn = nullptr;
+	void* m_fuelExhaustedUserData = nullptr;
+
+	// The temporaries that are still in use. The C++ code holds on to them while evaluating expressions,
+	// statement lists and loops drop the ones that they created once they are done with them (see releaseTempRoots).
+	std::vector<Var*> m_tempRoots;
+
+	// The channels that the script uses (see channels). The host points it to the group shared by the Executors that
+	// exchange values, otherwise the Executor gets a group of its own (m_ownChannels) the first time that the script opens a channel.
+	ChannelGroup* m_channels = nullptr;
+	std::unique_ptr<ChannelGroup> m_ownChannels;
+}; 
+
+// The Executors that a thread is done with, kept for the scripts that it runs next (see Executor::reset).
+// Each thread has its own pool, as an Executor belongs to the thread that created it (see Heap::bindToCurrentThread).
+// Native functions registered by the host are kept by reset, so the hosts that share a thread see each other's natives.
+struct ExecutorPool
+{
+	static constexpr size_t kMaxIdleExecutors = 4;
+
+	// An Executor taken from the pool of the calling thread, given back when the lease ends. The lease must end on the same thread.
+	struct Lease
+	{
+		Lease()
+			: m_executor(acquire())
+		{}
+
+		Lease(const Lease&) = delete;
+		Lease& operator=(const Lease&) = delete;
+
+		~Lease() {
+			release(std::move(m_executor));
+		}
+
+		Executor& operator*() const { return *m_executor; }
+		Executor* operator->() const { return m_executor.get(); }
+
+	private :
+		std::unique_ptr<Executor> m_executor;
+	};
+
+	// Returns an Executor in the state it had once constructed, a new one only if the pool is empty.
+	static std::unique_ptr<Executor> acquire() {
+		std::vector<std::unique_ptr<Executor>>& executors = idleExecutors();
+		if(executors.empty()) {
+			return std::unique_ptr<Executor>(new Executor());
+		}
+
+		std::unique_ptr<Executor> exec = std::move(executors.back());
+		executors.pop_back();
+		return exec;
+	}
+
+	// Resets @exec and keeps it for the next acquire on this thread. It is freed instead if the pool is full.
+	// Resetting right away frees the memory of the script, instead of keeping it until the Executor is used again.
+	static void release(std::unique_ptr<Executor> exec) {
+		std::vector<std::unique_ptr<Executor>>& executors = idleExecutors();
+		if(executors.size() < kMaxIdleExecutors) {
+			exec->reset();
+			executors.push_back(std::move(exec));
+		}
+	}
+
+private :
+
+	static std::vector<std::unique_ptr<Executor>>& idleExecutors() {
+		thread_local std::vector<std::unique_ptr<Executor>> executors;
+		return executors;
+	}
+};
+
+//-----------------------------------------------------------------------------------------------------
+// Ahead-of-time compilation.
+// The AotEmitter translates the AST of a script to C++ code that calls the Executor directly, instead of walking the AST.
+// That code is built by the system compiler into a shared library (a module), and the AotModule loads it in place of
+// interpreting the script. Anything that the emitter doesn't translate is evaluated by the Executor as usual.
+//-----------------------------------------------------------------------------------------------------
+
+// Changes whenever the generated code could stop working with the runtime, modules built for another runtime are refused.
+inline uint64_t aotRuntimeId()
+{
+	static const uint64_t kAotAbiVersion = 1;
+	return kAotAbiVersion | ((uint64_t)sizeof(Var) << 16) | ((uint64_t)sizeof(Executor) << 32);
+}
+
+// Lists the nodes of the AST in a fixed order. The generated code refers to the nodes by their index in that list,
+// so the emitter and the loader must produce the same list out of the same script.
+inline void collectAstNodes(const AstNode* const node, std::vector<const AstNode*>& nodes)
+{
+	if(node == nullptr) {
+		return;
+	}
+
+	nodes.push_back(node);
+
+	switch(node->type)
+	{
+		case astNodeType_memberAccess:
+			collectAstNodes(((AstMemberAcess*)node)->left, nodes);
+			break;
+		case astNodeType_tableMaker:
+			for(const auto& pair : ((AstTableMaker*)node)->memberToExpression) {
+				collectAstNodes(pair.second, nodes);
+			}
+			break;
+		case astNodeType_arrayMaker:
+			for(const AstNode* const expr : ((AstArrayMaker*)node)->arrayElements) {
+				collectAstNodes(expr, nodes);
+			}
+			break;
+		case astNodeType_binop:
+			collectAstNodes(((AstBinOp*)node)->left, nodes);
+			collectAstNodes(((AstBinOp*)node)->right, nodes);
+			break;
+		case astNodeType_unop:
+			collectAstNodes(((AstUnOp*)node)->left, nodes);
+			break;
+		case astNodeType_fnCall:
+			collectAstNodes(((AstFnCall*)node)->theFunction, nodes);
+			for(const AstNode* const arg : ((AstFnCall*)node)->callArgs) {
+				collectAstNodes(arg, nodes);
+			}
+			break;
+		case astNodeType_arrayIndexing:
+			collectAstNodes(((AstArrayIndexing*)node)->theArray, nodes);
+			collectAstNodes(((AstArrayIndexing*)node)->index, nodes);
+			break;
+		case astNodeType_assign:
+			collectAstNodes(((AstAssign*)node)->left, nodes);
+			collectAstNodes(((AstAssign*)node)->right, nodes);
+			break;
+		case astNodeType_statementList:
+			for(const AstNode* const statement : ((AstStatementList*)node)->m_statements) {
+				collectAstNodes(statement, nodes);
+			}
+			break;
+		case astNodeType_if:
+			collectAstNodes(((AstIf*)node)->expression, nodes);
+			collectAstNodes(((AstIf*)node)->trueBranchStatement, nodes);
+			collectAstNodes(((AstIf*)node)->falseBranchStatement, nodes);
+			break;
+		case astNodeType_while:
+			collectAstNodes(((AstWhile*)node)->expression, nodes);
+			collectAstNodes(((AstWhile*)node)->trueBranchStatement, nodes);
+			break;
+		case astNodeType_for:
+			collectAstNodes(((AstFor*)node)->initExpression, nodes);
+			collectAstNodes(((AstFor*)node)->expression, nodes);
+			collectAstNodes(((AstFor*)node)->postIterationExpression, nodes);
+			collectAstNodes(((AstFor*)node)->trueBranchStatement, nodes);
+			break;
+		case astNodeType_print:
+			collectAstNodes(((AstPrint*)node)->expression, nodes);
+			break;
+		case astNodeType_return:
+			collectAstNodes(((AstReturn*)node)->expression, nodes);
+			break;
+		case astNodeType_fndecl:
+			collectAstNodes(((AstFnDecl*)node)->fnBodyBlock, nodes);
+			break;
+		default:
+			break;
+	}
+}
+
+// Generates the C++ code of a module out of the AST of a script, after TypeInference had run on it.
+// Each function of the script and the script itself become a C++ function. Expressions are evaluated into
+// local variables named after the index of their node, in the same order as the Executor evaluates them.
+struct AotEmitter
+{
+	// @runtimePath is the file that has the runtime (this file), included by the generated code.
+	std::string emit(const AstNode* const program, const uint64_t sourceHash, const std::string& runtimePath) {
+		collectAstNodes(program, m_nodes);
+		for(size_t t = 0; t < m_nodes.size(); ++t) {
+			m_nodeIndices[m_nodes[t]] = (int)t;
+		}
+
+		std::string escapedRuntimePath;
+		for(const char c : runtimePath) {
+			if(c == '\\' || c == '"') escapedRuntimePath += '\\';
+			escapedRuntimePath += c;
+		}
+
+		m_out << "// Generated ahead of time out of a script, do not edit.\n";
+		m_out << "// Build with: c++ -std=c++17 -O2 -shared -fPIC -I <directory of the runtime> -o <module> <this file>\n";
+		m_out << "#define BLOG_AOT_MODULE\n";
+		m_out << "#ifndef BLOG_AOT_RUNTIME\n";
+		m_out << "\t#define BLOG_AOT_RUNTIME \"" << escapedRuntimePath << "\"\n";
+		m_out << "#endif\n";
+		m_out << "#include BLOG_AOT_RUNTIME\n\n";
+		m_out << "static const AstNode* const* aot_nodes = nullptr;\n\n";
+
+		std::vector<const AstFnDecl*> functions;
+		for(const AstNode* const node : m_nodes) {
+			if(node->type == astNodeType_fndecl) {
+				functions.push_back((AstFnDecl*)node);
+			}
+		}
+
+		emitFunction("aot_program", program);
+		for(const AstFnDecl* const fnDecl : functions) {
+			emitFunction(functionName(fnDecl), fnDecl->fnBodyBlock);
+		}
+
+		m_out << "BLOG_AOT_EXPORT uint64_t blog_aot_runtime_id() { return aotRuntimeId(); }\n";
+		m_out << "BLOG_AOT_EXPORT uint64_t blog_aot_source_hash() { return " << sourceHash << "ull; }\n";
+		m_out << "BLOG_AOT_EXPORT size_t blog_aot_node_count() { return " << m_nodes.size() << "; }\n";
+		m_out << "BLOG_AOT_EXPORT void blog_aot_bind(const AstNode* const* nodes) { aot_nodes = nodes; }\n";
+		m_out << "BLOG_AOT_EXPORT AotCompiledFn blog_aot_program() { return aot_program; }\n\n";
+		m_out << "// The compiled body of the function declared by the specified node.\n";
+		m_out << "BLOG_AOT_EXPORT AotCompiledFn blog_aot_function(size_t nodeIndex) {\n";
+		m_out << "\tswitch(nodeIndex) {\n";
+		for(const AstFnDecl* const fnDecl : functions) {
+			m_out << "\t\tcase " << indexOf(fnDecl) << ": return " << functionName(fnDecl) << ";\n";
+		}
+		m_out << "\t}\n";
+		m_out << "\treturn nullptr;\n";
+		m_out << "}\n";
+
+		return m_out.str();
+	}
+
+private :
+
+	std::string functionName(const AstFnDecl* const fnDecl) {
+		return "aot_fn" + std::to_string(indexOf(fnDecl));
+	}
+
+	int indexOf(const AstNode* const node) {
+		return m_nodeIndices.at(node);
+	}
+
+	// The expression that gets the node inside the generated code, casted to its type.
+	std::string nodeRef(const AstNode* const node, const char* const nodeType) {
+		return std::string("((const ") + nodeType + "*)aot_nodes[" + std::to_string(indexOf(node)) + "])";
+	}
+
+	std::string var(const AstNode* const node) {
+		return "v" + std::to_string(indexOf(node));
+	}
+
+	void line(const std::string& code) {
+		for(int t = 0; t < m_indent; ++t) {
+			m_out << '\t';
+		}
+		m_out << code << '\n';
+	}
+
+	void emitFunction(const std::string& name, const AstNode* const body) {
+		line("static Var* " + name + "(Executor* const e) {");
+		m_indent++;
+		line("Executor::EvalCtx ctx; // For the parts that are evaluated by the Executor.");
+		line("const size_t scopeDepth = e->m_scopeStack.size();");
+		line("(void)scopeDepth;");
+		emitStatement(body);
+		line("return nullptr;");
+		m_indent--;
+		line("}");
+		line("");
+	}
+
+	// Emits the code that evaluates the node on its own, through the Executor.
+	std::string emitEvaluated(const AstNode* const node) {
+		line("Var* const " + var(node) + " = e->evaluate(aot_nodes[" + std::to_string(indexOf(node)) + "], ctx);");
+		return var(node);
+	}
+
+	void emitStatement(const AstNode* const node) {
+		switch(node->type)
+		{
+			case astNodeType_statementList:
+			{
+				const AstStatementList* const n = (AstStatementList*)node;
+				const std::string watermark = "watermark" + std::to_string(indexOf(n));
+				line("{");
+				m_indent++;
+				if(n->needsOwnScope) {
+					line("e->pushScope(aot_nodes[" + std::to_string(indexOf(n)) + "], nullptr);");
+				}
+				line("const size_t " + watermark + " = e->m_tempRoots.size();");
+				for(const AstNode* const statement : n->m_statements) {
+					line("e->releaseTempRoots(" + watermark + ");");
+					line("e->gcSafePoint(aot_nodes[" + std::to_string(indexOf(statement)) + "]->location);");
+					emitStatement(statement);
+				}
+				if(n->needsOwnScope) {
+					line("e->popScope();");
+				}
+				m_indent--;
+				line("}");
+			}break;
+			case astNodeType_if:
+			{
+				const AstIf* const n = (AstIf*)node;
+				const std::string nodeIdx = std::to_string(indexOf(n));
+				line("{");
+				m_indent++;
+				line("const bool c" + nodeIdx + " = " + emitCondition(n->expression) + ";");
+				line("if(c" + nodeIdx + ") {");
+				emitScopedStatement(n, "\"true\"", n->trueBranchStatement);
+				if(n->falseBranchStatement) {
+					line("} else {");
+					emitScopedStatement(n, "\"false\"", n->falseBranchStatement);
+				}
+				line("}");
+				m_indent--;
+				line("}");
+			}break;
+			case astNodeType_while:
+			{
+				const AstWhile* const n = (AstWhile*)node;
+				const std::string nodeIdx = std::to_string(indexOf(n));
+				line("{");
+				m_indent++;
+				line("e->pushScope(aot_nodes[" + nodeIdx + "], nullptr);");
+				line("const size_t watermark" + nodeIdx + " = e->m_tempRoots.size();");
+				line("while(true) {");
+				m_indent++;
+				line("e->releaseTempRoots(watermark" + nodeIdx + ");");
+				line("e->gcSafePoint(aot_nodes[" + nodeIdx + "]->location);");
+				line("e->burnFuel(aot_nodes[" + nodeIdx + "]->location);");
+				line("const bool c" + nodeIdx + " = " + emitCondition(n->expression) + ";");
+				line("if(!c" + nodeIdx + ") break;");
+				emitStatement(n->trueBranchStatement);
+				m_indent--;
+				line("}");
+				line("e->popScope();");
+				m_indent--;
+				line("}");
+			}break;
+			case astNodeType_for:
+			{
+				emitFor((AstFor*)node);
+			}break;
+			case astNodeType_return:
+			{
+				// Like in the Executor, a return without a value doesn't stop the function.
+				const AstReturn* const n = (AstReturn*)node;
+				if(n->expression) {
+					line("{");
+					m_indent++;
+					const std::string value = emitExpression(n->expression);
+					line("Var* const result = e->newVariableCopy(*" + value + ");");
+					line("while(e->m_scopeStack.size() > scopeDepth) e->popScope();");
+					line("return result;");
+					m_indent--;
+					line("}");
+				}
+			}break;
+			case astNodeType_print:
+			{
+				const AstPrint* const n = (AstPrint*)node;
+				line("{");
+				m_indent++;
+				const std::string value = emitExpression(n->expression);
+				line("printVariable(e->m_output, " + value + ");");
+				m_indent--;
+				line("}");
+			}break;
+			default:
+			{
+				line("{");
+				m_indent++;
+				const std::string value = emitExpression(node);
+				line("(void)" + value + ";");
+				m_indent--;
+				line("}");
+			}break;
+		}
+	}
+
+	// The branches of an if statement are evaluated in their own scope.
+	void emitScopedStatement(const AstNode* const scopeNode, const char* const postfix, const AstNode* const statement) {
+		m_indent++;
+		line("e->pushScope(aot_nodes[" + std::to_string(indexOf(scopeNode)) + "], " + postfix + ");");
+		emitStatement(statement);
+		line("e->popScope();");
+		m_indent--;
+	}
+
+	// Like the Executor, counted loops resolve their counter and bound once and step the counter in place.
+	void emitFor(const AstFor* const n) {
+		const std::string nodeIdx = std::to_string(indexOf(n));
+		const std::string counter = "counter" + nodeIdx;
+		const std::string bound = "bound" + nodeIdx;
+
+		line("{");
+		m_indent++;
+		line("e->pushScope(aot_nodes[" + nodeIdx + "], nullptr);");
+		emitStatement(n->initExpression);
+
+		if(n->counter) {
+			line("Var* const " + counter + " = e->evaluateIdentifier(" + nodeRef(n->counter, "AstIdentifier") + ");");
+			if(n->bound->type == astNodeType_number) {
+				line("Var " + bound + "Literal;");
+				line(bound + "Literal.makeInt64(" + std::to_string(((AstNumber*)n->bound)->integerValue) + "ll);");
+				line("const Var* const " + bound + " = &" + bound + "Literal;");
+			} else {
+				line("const Var* const " + bound + " = e->evaluateIdentifier(" + nodeRef(n->bound, "AstIdentifier") + ");");
+			}
+		}
+
+		line("const size_t watermark" + nodeIdx + " = e->m_tempRoots.size();");
+		line("while(true) {");
+		m_indent++;
+		line("e->releaseTempRoots(watermark" + nodeIdx + ");");
+		line("e->gcSafePoint(aot_nodes[" + nodeIdx + "]->location);");
+		line("e->burnFuel(aot_nodes[" + nodeIdx + "]->location);");
+
+		if(n->counter) {
+			line("bool c" + nodeIdx + " = false;");
+			line("if(" + counter + "->m_varType == varType_i64 && " + bound + "->m_varType == varType_i64) {");
+			m_indent++;
+			line("c" + nodeIdx + " = " + counter + "->m_value_i64 " + comparisonOperator(n->counterComparison) + " " + bound + "->m_value_i64;");
+			m_indent--;
+			line("} else {");
+			m_indent++;
+			line("c" + nodeIdx + " = " + emitCondition(n->expression) + ";");
+			m_indent--;
+			line("}");
+		} else {
+			line("const bool c" + nodeIdx + " = " + emitCondition(n->expression) + ";");
+		}
+
+		line("if(!c" + nodeIdx + ") break;");
+		emitStatement(n->trueBranchStatement);
+
+		if(n->counter) {
+			const int64_t step = ((AstAssign*)n->postIterationExpression)->incrementStep;
+			line("int64_t next" + nodeIdx + " = 0;");
+			line("if(" + counter + "->m_varType == varType_i64 && checkedAdd(" + counter + "->m_value_i64, " + std::to_string(step) + "ll, next" + nodeIdx + ")) {");
+			m_indent++;
+			line(counter + "->m_value_i64 = next" + nodeIdx + ";");
+			m_indent--;
+			line("} else {");
+			m_indent++;
+			emitStatement(n->postIterationExpression);
+			m_indent--;
+			line("}");
+		} else {
+			emitStatement(n->postIterationExpression);
+		}
+
+		m_indent--;
+		line("}");
+		line("e->popScope();");
+		m_indent--;
+		line("}");
+	}
+
+	// Emits the code evaluating the condition of an if/while/for, returns a C++ expression of type bool.
+	// Comparisons don't make a variable for their result, and the ones proven to be on integers or floats are native comparisons.
+	std::string emitCondition(const AstNode* const expression) {
+		if(expression->type == astNodeType_binop) {
+			const AstBinOp* const n = (AstBinOp*)expression;
+			if(n->operation >= binOpOperation_equals) {
+				const std::string left = emitExpression(n->left);
+				const std::string right = emitExpression(n->right);
+
+				if(n->form == binOpForm_i64) {
+					return "(" + left + "->m_value_i64 " + comparisonOperator(n->operation) + " " + right + "->m_value_i64)";
+				}
+				if(n->form == binOpForm_f32) {
+					return "(" + left + "->m_value_f32 " + comparisonOperator(n->operation) + " " + right + "->m_value_f32)";
+				}
+				return "Executor::compareOperands(" + nodeRef(n, "AstBinOp") + ", " + left + ", " + right + ")";
+			}
+		}
+
+		return emitExpression(expression) + "->isTrue()";
+	}
+
+	// Emits the code evaluating the expression, returns the name of the C++ variable holding the result.
+	std::string emitExpression(const AstNode* const node) {
+		const std::string result = var(node);
+
+		switch(node->type)
+		{
+			case astNodeType_number:
+			{
+				const AstNumber* const n = (AstNumber*)node;
+				if(n->isInteger) {
+					line("Var* const " + result + " = e->newVariableInt64(" + std::to_string(n->integerValue) + "ll);");
+				} else {
+					char literal[64];
+					snprintf(literal, sizeof(literal), "%af", (double)n->value); // Hexadecimal, so the value is exact.
+					line("Var* const " + result + " = e->newVariableFloat(" + literal + ");");
+				}
+			}break;
+			case astNodeType_string:
+			{
+				line("Var* const " + result + " = e->newVariableString(" + nodeRef(node, "AstString") + "->value);");
+			}break;
+			case astNodeType_identifier:
+			{
+				line("Var* const " + result + " = e->evaluateIdentifier(" + nodeRef(node, "AstIdentifier") + ");");
+			}break;
+			case astNodeType_fndecl:
+			{
+				line("Var* const " + result + " = e->newVariableFunction(" + nodeRef(node, "AstFnDecl") + ");");
+			}break;
+			case astNodeType_memberAccess:
+			{
+				const AstMemberAcess* const n = (AstMemberAcess*)node;
+				const std::string left = emitExpression(n->left);
+				line("Var* const " + result + " = e->evaluateMemberAccess(" + nodeRef(n, "AstMemberAcess") + ", " + left + ");");
+			}break;
+			case astNodeType_binop:
+			{
+				const AstBinOp* const n = (AstBinOp*)node;
+				const std::string left = emitExpression(n->left);
+				const std::string right = emitExpression(n->right);
+				const std::string operation = binOpOperationName(n->operation);
+
+				switch(n->form) {
+					case binOpForm_i64:
+						line("Var* const " + result + " = e->evaluateInt64BinOp(" + operation + ", " + left + "->m_value_i64, " + right + "->m_value_i64);");
+						break;
+					case binOpForm_f32:
+						line("Var* const " + result + " = e->evaluateFloat32BinOp(" + operation + ", " + left + "->m_value_f32, " + right + "->m_value_f32);");
+						break;
+					case binOpForm_stringConcat:
+						line("Var* const " + result + " = e->newVariableString(StringRef::concat(" + left + "->m_value_string, " + right + "->m_value_string));");
+						break;
+					case binOpForm_stringEquals:
+						line("Var* const " + result + " = e->newVariableBool(" + left + "->m_value_string == " + right + "->m_value_string);");
+						break;
+					default:
+						// Mixed numbers and the generic form, the Executor checks the types (and quickens the operation).
+						line("Var* const " + result + " = e->evaluateBinOp(" + nodeRef(n, "AstBinOp") + ", " + left + ", " + right + ");");
+						break;
+				}
+			}break;
+			case astNodeType_unop:
+			{
+				const AstUnOp* const n = (AstUnOp*)node;
+				const std::string left = emitExpression(n->left);
+				line("Var* const " + result + " = e->evaluateUnOp(" + nodeRef(n, "AstUnOp") + ", " + left + ");");
+			}break;
+			case astNodeType_assign:
+			{
+				const AstAssign* const n = (AstAssign*)node;
+				if(n->left->type == astNodeType_arrayIndexing) {
+					return emitEvaluated(node);
+				}
+
+				const std::string left = emitExpression(n->left);
+				if(n->isIncrement) {
+					const std::string nextValue = "next" + std::to_string(indexOf(n));
+					line("int64_t " + nextValue + " = 0;");
+					line("if(" + left + "->m_varType == varType_i64 && checkedAdd(" + left + "->m_value_i64, " + std::to_string(n->incrementStep) + "ll, " + nextValue + ")) {");
+					m_indent++;
+					line(left + "->m_value_i64 = " + nextValue + ";");
+					m_indent--;
+					line("} else {");
+					m_indent++;
+					const std::string right = emitExpression(n->right);
+					line("e->assignVar(" + left + ", *" + right + ");");
+					m_indent--;
+					line("}");
+				} else {
+					const std::string right = emitExpression(n->right);
+					line("e->assignVar(" + left + ", *" + right + ");");
+				}
+				line("Var* const " + result + " = " + left + ";");
+			}break;
+			case astNodeType_fnCall:
+			{
+				// Functions inlined by the Executor are evaluated by it, arguments included.
+				const AstFnCall* const n = (AstFnCall*)node;
+				const std::string nodeIdx = std::to_string(indexOf(n));
+				const std::string fn = emitExpression(n->theFunction);
+				line("const AstFnDecl* const fnDecl" + nodeIdx + " = Executor::resolveCallSite(" + nodeRef(n, "AstFnCall") + ", " + fn + ");");
+				line("Var* " + result + " = nullptr;");
+				line("if(fnDecl" + nodeIdx + " && " + nodeRef(n, "AstFnCall") + "->inlinedBody) {");
+				m_indent++;
+				line(result + " = e->evaluateInlinedCall(" + nodeRef(n, "AstFnCall") + ", ctx);");
+				m_indent--;
+				line("} else {");
+				m_indent++;
+
+				std::string arguments;
+				for(const AstNode* const arg : n->callArgs) {
+					arguments += (arguments.empty() ? "" : ", ") + emitExpression(arg);
+				}
+
+				const std::string argc = std::to_string(n->callArgs.size());
+				if(n->callArgs.empty()) {
+					line("Var** const args" + nodeIdx + " = nullptr;");
+				} else {
+					line("Var* args" + nodeIdx + "[] = { " + arguments + " };");
+				}
+				line(result + " = fnDecl" + nodeIdx
+					+ " ? e->callScriptFunction(fnDecl" + nodeIdx + ", " + argc + ", args" + nodeIdx + ")"
+					+ " : e->callFunction(" + fn + ", " + argc + ", args" + nodeIdx + ", " + nodeRef(n, "AstFnCall") + "->location);");
+				m_indent--;
+				line("}");
+			}break;
+			default:
+			{
+				// Tables, arrays and indexing are left to the Executor.
+				return emitEvaluated(node);
+			}break;
+		}
+
+		return result;
+	}
+
+	static const char* comparisonOperator(const BinOpOperation operation) {
+		switch(operation) {
+			case binOpOperation_equals: return "==";
+			case binOpOperation_notEquals: return "!=";
+			case binOpOperation_lessEquals: return "<=";
+			case binOpOperation_greaterEquals: return ">=";
+			case binOpOperation_less: return "<";
+			case binOpOperation_greater: return ">";
+			default: assert(false); return "";
+		}
+	}
+
+	static const char* binOpOperationName(const BinOpOperation operation) {
+		switch(operation) {
+			case binOpOperation_add: return "binOpOperation_add";
+			case binOpOperation_sub: return "binOpOperation_sub";
+			case binOpOperation_mul: return "binOpOperation_mul";
+			case binOpOperation_div: return "binOpOperation_div";
+			case binOpOperation_equals: return "binOpOperation_equals";
+			case binOpOperation_notEquals: return "binOpOperation_notEquals";
+			case binOpOperation_lessEquals: return "binOpOperation_lessEquals";
+			case binOpOperation_greaterEquals: return "binOpOperation_greaterEquals";
+			case binOpOperation_less: return "binOpOperation_less";
+			case binOpOperation_greater: return "binOpOperation_greater";
+			default: return "binOpOperation_none";
+		}
+	}
+
+	std::vector<const AstNode*> m_nodes;
+	std::unordered_map<const AstNode*, int> m_nodeIndices;
+	std::ostringstream m_out;
+	int m_indent = 0;
+};
+
+// A module built out of the code generated by the AotEmitter.
+// Once loaded, the functions of the script are called through their compiled code (see AstFnDecl::compiledBody).
+// The module stays loaded for the lifetime of the process, as the AST points into it.
+struct AotModule
+{
+	// Loads the module for the script whose source has the specified hash and AST. On failure, @error tells why,
+	// and the script should be interpreted instead.
+	bool load(const char* const path, AstNode* const program, const uint64_t sourceHash, std::string& error) {
+#if defined(_WIN32)
+		void* const handle = LoadLibraryA(path);
+#else
+		void* const handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+#endif
+		if(handle == nullptr) {
+			error = "could not load the module";
+			return false;
+		}
+
+		typedef uint64_t (*GetU64Fn)();
+		typedef size_t (*GetSizeFn)();
+		typedef void (*BindFn)(const AstNode* const*);
+		typedef AotCompiledFn (*GetProgramFn)();
+		typedef AotCompiledFn (*GetFunctionFn)(size_t);
+
+		const GetU64Fn getRuntimeId = (GetU64Fn)findSymbol(handle, "blog_aot_runtime_id");
+		const GetU64Fn getSourceHash = (GetU64Fn)findSymbol(handle, "blog_aot_source_hash");
+		const GetSizeFn getNodeCount = (GetSizeFn)findSymbol(handle, "blog_aot_node_count");
+		const BindFn bind = (BindFn)findSymbol(handle, "blog_aot_bind");
+		const GetProgramFn getProgram = (GetProgramFn)findSymbol(handle, "blog_aot_program");
+		const GetFunctionFn getFunction = (GetFunctionFn)findSymbol(handle, "blog_aot_function");
+
+		if(!getRuntimeId || !getSourceHash || !getNodeCount || !bind || !getProgram || !getFunction) {
+			error = "not a module";
+			return false;
+		}
+
+		if(getRuntimeId() != aotRuntimeId()) {
+			error = "the module was built for a different runtime";
+			return false;
+		}
+
+		collectAstNodes(program, m_nodes);
+		if(getSourceHash() != sourceHash || getNodeCount() != m_nodes.size()) {
+			error = "the module was built for a different script";
+			return false;
+		}
+
+		bind(m_nodes.data());
+		for(size_t t = 0; t < m_nodes.size(); ++t) {
+			if(m_nodes[t]->type == astNodeType_fndecl) {
+				((AstFnDecl*)m_nodes[t])->compiledBody = getFunction(t);
+			}
+		}
+		m_program = getProgram();
+
+		return true;
+	}
+
+	// The compiled code of the script itself (see Executor::run).
+	AotCompiledFn program() const {
+		return m_program;
+	}
+
+private :
+
+	static void* findSymbol(void* const handle, const char* const name) {
+#if defined(_WIN32)
+		return GetProcAddress(handle, name);
+#else
+		return dlsym(handle, name);
+#endif
+	}
+
+	std::vector<const AstNode*> m_nodes; // Indexed the same way as in the generated code (see collectAstNodes).
+	AotCompiledFn m_program = nullptr;
+};
+
+//-----------------------------------------------------------------------------------------------------
+// Heap snapshots.
+// A script usually spends its start building tables and computing constants. The state that it leaves behind
+// (the global variables and everything reachable from them) could be saved once, and restored into new Executors
+// instead of running the script again. Each restore makes its own copies, so the restored Executors are independent.
+//-----------------------------------------------------------------------------------------------------
+
+// Snapshots are value files (see ValueWriter) whose roots are the global variables.
+struct HeapSnapshot
+{
+	// Saves the global variables of @exec to a file. It should be called once the script is done, as the variables of the scopes that
+	// are still running aren't saved. The builtins that weren't reassigned are left out, the Executor that restores the snapshot has them.
+	bool save(const Executor& exec, const uint64_t sourceHash, const char* const path, std::string& error) {
+		// Sort the globals by name, so the same state always gives the same snapshot.
+		// Globals are the variables whose names aren't prefixed by a scope (see Executor::findVariableInScope).
+		std::vector<std::pair<const std::string*, const Var*>> globals;
+		for(const auto& itr : exec.m_variablesLut) {
+			const Var& value = *itr.second;
+			if(itr.first.find(' ') != std::string::npos) {
+				continue;
+			}
+			if(value.m_varType == varType_fnNative && exec.findNativeFunction(itr.first) == value.m_fnNative) {
+				continue;
+			}
+			globals.emplace_back(&itr.first, &value);
+		}
+		std::sort(globals.begin(), globals.end(), [](const auto& a, const auto& b) { return *a.first < *b.first; });
+
+		ValueWriter writer(exec.m_nativeFunctions);
+		for(const auto& global : globals) {
+			writer.addRoot(*global.first, *global.second);
+		}
+		return writer.write(sourceHash, path, error);
+	}
+
+	// Restores the global variables saved by @save into @exec. The script must be the same one, parsed by @parser, and the host
+	// must have registered the same native functions. Nothing is modified unless the whole snapshot is valid.
+	// Nothing should be running on @exec, the restored variables are created in the global scope.
+	bool restore(Executor& exec, const Parser& parser, const uint64_t sourceHash, const char* const path, std::string& error) {
+		MappedFile file;
+		if(!file.open(path)) {
+			error = "could not read the file";
+			return false;
+		}
+
+		ValueReader reader(exec.m_heap, &parser, exec.m_nativeFunctions);
+		if(!reader.read(file.data(), file.size(), sourceHash, error)) {
+			return false;
+		}
+
+		for(const auto& global : reader.roots) {
+			const std::string name(global.first.view());
+			Var* const var = exec.findVariableInScope(name, Symbols::intern(name), true, false);
+			exec.assignVar(var, global.second);
+		}
+
+		return true;
+	}
+};
+
+#ifndef BLOG_AOT_MODULE
+
+//-----------------------------------------------------------------------------------------------------
+// Daemon mode.
+// A long running process that runs scripts on request, so a request doesn't pay for starting a process, and a script
+// that was seen before isn't parsed again. Requests are read from stdin (and answered on stdout), or from the connections
+// to a Unix domain socket. A request is one of:
+//   run <path>\n                   Runs the script in that file.
+//   eval <size>\n<source>          Runs the <size> bytes of source that follow.
+// The requests of a connection are numbered from 0 and run concurrently on a pool of workers, so the answers are tagged with that number:
+//   <id> out <size>\n<data>        A part of the output of the script, sent as it is produced.
+//   <id> done\n                    The script finished.
+//   <id> error <size>\n<message>   The script failed or could not be read, nothing else follows for that request.
+// Every request runs in an Executor that was just made or reset (see ExecutorPool), scripts never share their variables.
+//-----------------------------------------------------------------------------------------------------
+
+// A parsed and analyzed script, ready to be run. The AST keeps caches that are updated while the script runs
+// (call sites, member accesses, inlined bodies and quickened operations), so a program is used by a single thread at a time,
+// the threads that run the same script at the same time compile their own copy.
+// The Executor that ran a program must be reset before the program is freed, as its values could reference the constants of the Parser.
+struct CompiledProgram
+{
+	std::string source;
+	uint64_t sourceHash = 0;
+	Parser parser; // Declared before the nodes, as they use the string constants that it owns.
+	AstNodeOwner nodes;
+	AstNode* root = nullptr;
+};
+
+// Lexes, parses and analyzes @source. Throws an Error if the script is invalid.
+static std::unique_ptr<CompiledProgram> compileProgram(std::string source, const uint64_t sourceHash)
+{
+	std::unique_ptr<CompiledProgram> program(new CompiledProgram());
+	program->source = std::move(source);
+	program->sourceHash = sourceHash;
+
+	AstNodeOwner::Scope ownerScope(&program->nodes);
+
+	std::vector<Token> tokens;
+	Lexer lexer;
+	lexer.getAllTokens(program->source.c_str(), tokens);
+
+	program->parser.m_token = tokens.data();
+	program->root = program->parser.parse();
+
+	TypeInference typeInference;
+	typeInference.run(program->root);
+
+	return program;
+}
+
+// The programs that aren't running, keyed by the hash of their source. A program is taken out of the cache while it runs,
+// so when the same script is requested concurrently, each request gets its own copy of the program.
+struct ProgramCache
+{
+	explicit ProgramCache(const size_t capacity)
+		: m_capacity(capacity)
+	{}
+
+	// Returns a program for @source that no other thread is using, the source is only parsed if there is no such program in the cache.
+	std::unique_ptr<CompiledProgram> acquire(std::string source) {
+		const uint64_t sourceHash = fnv1aHash(source.data(), source.size());
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			for(size_t t = m_idle.size(); t-- > 0;) {
+				if(m_idle[t]->sourceHash == sourceHash && m_idle[t]->source == source) {
+					std::unique_ptr<CompiledProgram> program = std::move(m_idle[t]);
+					m_idle.erase(m_idle.begin() + t);
+					return program;
 				}
+			}
+		}
 
-				if(left->m_varType == varType_string && n->op == tokenType_plus)
-				{
-					// string + string
-					if(right->m_varType == varType_string) {
-						return newVariableString(left->m_value_string + right->m_value_string);
-					}
-					else if(right->m_varType == varType_f32) {
-						std::stringstream ss;
-						ss << right->m_value_f32;
-						return newVariableString(left->m_value_string + ss.str());
-					}
+		return compileProgram(std::move(source), sourceHash);
+	}
+
+	// Gives back a program returned by acquire, so the next request for that script starts with caches that are already warm.
+	// Once the cache is full, the program that was used least recently is freed.
+	void release(std::unique_ptr<CompiledProgram> program) {
+		std::unique_ptr<CompiledProgram> evicted;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_idle.push_back(std::move(program));
+			if(m_idle.size() > m_capacity) {
+				evicted = std::move(m_idle.front());
+				m_idle.erase(m_idle.begin());
+			}
+		}
+		// The evicted program is freed here, outside of the lock.
+	}
+
+private :
+	const size_t m_capacity;
+	std::mutex m_mutex;
+	std::vector<std::unique_ptr<CompiledProgram>> m_idle; // The most recently used are at the back.
+};
+
+// A client of the daemon. The workers answer its requests concurrently, so each answer is written at once.
+struct DaemonConnection
+{
+	DaemonConnection(FILE* const in, FILE* const out)
+		: in(in)
+		, out(out)
+	{}
+
+	DaemonConnection(const DaemonConnection&) = delete;
+	DaemonConnection& operator=(const DaemonConnection&) = delete;
+
+	// The connection is closed once the client stopped sending requests and every answer was written.
+	~DaemonConnection() {
+		if(in != stdin) fclose(in);
+		if(out != stdout) fclose(out);
+	}
+
+	// Writes "<id> <kind>\n", followed by the size and the data if @data isn't null.
+	void writeFrame(const uint64_t id, const char* const kind, const char* const data, const size_t size) {
+		char header[64];
+		const int headerSize = data
+			? snprintf(header, sizeof(header), "%llu %s %zu\n", (unsigned long long)id, kind, size)
+			: snprintf(header, sizeof(header), "%llu %s\n", (unsigned long long)id, kind);
+
+		std::lock_guard<std::mutex> lock(m_writeMutex);
+		fwrite(header, 1, headerSize, out);
+		if(data) {
+			fwrite(data, 1, size, out);
+		}
+		fflush(out);
+	}
+
+	FILE* const in;
+	FILE* const out;
+
+private :
+	std::mutex m_writeMutex;
+};
+
+struct DaemonRequest
+{
+	std::shared_ptr<DaemonConnection> connection;
+	uint64_t id = 0;
+	bool isPath = false; // If true, the script is the path of the file with the source.
+	std::string script;
+};
+
+struct Daemon
+{
+	static constexpr size_t kMaxRequestLine = 4096;
+	static constexpr size_t kMaxSourceSize = 64 * 1024 * 1024;
+
+	// @fuel and @heapLimit are the limits of each request (see Executor::setLimits).
+	Daemon(const size_t workerCount, const int64_t fuel, const size_t heapLimit)
+		: m_programs(workerCount * 16)
+		, m_fuel(fuel)
+		, m_heapLimit(heapLimit)
+	{
+		for(size_t t = 0; t < workerCount; ++t) {
+			m_workers.emplace_back([this]() { runWorker(); });
+		}
+	}
+
+	// Finishes the requests that were already received.
+	~Daemon() {
+		{
+			std::lock_guard<std::mutex> lock(m_queueMutex);
+			m_isStopping = true;
+		}
+		m_queueChanged.notify_all();
+
+		for(std::thread& worker : m_workers) {
+			worker.join();
+		}
+	}
+
+	// Serves the requests read from stdin, until it is closed.
+	void serveStdin() {
+		readRequests(std::make_shared<DaemonConnection>(stdin, stdout));
+	}
+
+	// Serves the clients that connect to a Unix domain socket created at @path. Only returns if the socket can't be used.
+	bool serveSocket(const char* const path, std::string& error) {
+#if defined(_WIN32)
+		error = "Unix domain sockets aren't supported on this platform";
+		return false;
+#else
+		sockaddr_un address = {};
+		address.sun_family = AF_UNIX;
+		if(strlen(path) >= sizeof(address.sun_path)) {
+			error = "the path of the socket is too long";
+			return false;
+		}
+		strcpy(address.sun_path, path);
+
+		const int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if(listenFd < 0) {
+			error = "could not create the socket";
+			return false;
+		}
+
+		unlink(path);
+		if(bind(listenFd, (const sockaddr*)&address, sizeof(address)) != 0 || listen(listenFd, 64) != 0) {
+			error = "could not listen on the socket";
+			close(listenFd);
+			return false;
+		}
+
+		// A client that disconnects before its answers are written shouldn't stop the daemon.
+		signal(SIGPIPE, SIG_IGN);
+
+		for(;;) {
+			const int fd = accept(listenFd, nullptr, nullptr);
+			if(fd < 0) {
+				if(errno == EINTR || errno == ECONNABORTED) {
+					continue;
 				}
-				else if(right->m_varType == varType_string && n->op == tokenType_plus)
-				{
-					// string + string
-					if(left->m_varType == varType_string) {
-						return newVariableString(left->m_value_string + right->m_value_string);
-					}
-					else if(left->m_varType == varType_f32) {
-						std::stringstream ss;
-						ss << left->m_value_f32;
-						std::string reult = ss.str() + right->m_value_string;
-						return newVariableString(reult);
-					}
+				error = "could not accept a connection";
+				close(listenFd);
+				return false;
+			}
+
+			const int writeFd = dup(fd);
+			FILE* const in = fdopen(fd, "rb");
+			FILE* const out = writeFd >= 0 ? fdopen(writeFd, "wb") : nullptr;
+			if(in == nullptr || out == nullptr) {
+				if(in) fclose(in); else close(fd);
+				if(out) fclose(out); else if(writeFd >= 0) close(writeFd);
+				continue;
+			}
+
+			std::shared_ptr<DaemonConnection> connection = std::make_shared<DaemonConnection>(in, out);
+			std::thread([this, connection]() { readRequests(connection); }).detach();
+		}
+#endif
+	}
+
+private :
+
+	// Queues the requests of @connection for the workers, until the client stops sending them.
+	void readRequests(const std::shared_ptr<DaemonConnection>& connection) {
+		uint64_t nextId = 0;
+		std::string line;
+		while(readLine(connection->in, line)) {
+			if(line.empty()) {
+				continue;
+			}
+
+			DaemonRequest request;
+			request.connection = connection;
+			request.id = nextId++;
+
+			if(line.compare(0, 4, "run ") == 0) {
+				request.isPath = true;
+				request.script = line.substr(4);
+			}
+			else if(line.compare(0, 5, "eval ") == 0) {
+				const size_t size = (size_t)strtoull(line.c_str() + 5, nullptr, 10);
+				if(size > kMaxSourceSize) {
+					writeError(request, "The source is too big");
+					return; // The source can't be skipped without reading it, the rest of the stream can't be trusted.
 				}
-				
-				// Unknown operation.
-				ThrowError(n->location, "Uknown/Unimplemented binary operation");
-			}break;
-			case astNodeType_unop:
+
+				request.script.resize(size);
+				if(fread(&request.script[0], 1, size, connection->in) != size) {
+					writeError(request, "The source ended early");
+					return;
+				}
+			}
+			else {
+				writeError(request, "Unknown request: " + line);
+				continue;
+			}
+
 			{
-				const AstUnOp* const n = (AstUnOp*)root;
-				const Var* const left = evaluate(n->left, ctx);
+				std::lock_guard<std::mutex> lock(m_queueMutex);
+				m_queue.push_back(std::move(request));
+			}
+			m_queueChanged.notify_one();
+		}
+	}
+
+	// Reads a line without its end, returns false at the end of the stream.
+	static bool readLine(FILE* const in, std::string& line) {
+		line.clear();
+		for(int c = fgetc(in); c != '\n'; c = fgetc(in)) {
+			if(c == EOF) {
+				return line.empty() == false;
+			}
+			if(c != '\r' && line.size() < kMaxRequestLine) {
+				line.push_back((char)c);
+			}
+		}
+		return true;
+	}
+
+	void runWorker() {
+		for(;;) {
+			DaemonRequest request;
+			{
+				std::unique_lock<std::mutex> lock(m_queueMutex);
+				m_queueChanged.wait(lock, [this]() { return m_queue.empty() == false || m_isStopping; });
+				if(m_queue.empty()) {
+					return;
+				}
+				request = std::move(m_queue.front());
+				m_queue.pop_front();
+			}
+
+			execute(request);
+		}
+	}
+
+	void execute(const DaemonRequest& request) {
+		std::string source;
+		if(request.isPath) {
+			MappedFile file;
+			if(!file.open(request.script.c_str())) {
+				writeError(request, "Could not read " + request.script);
+				return;
+			}
+			source.assign(file.data() ? file.data() : "", file.size());
+		} else {
+			source = request.script;
+		}
+
+		std::unique_ptr<CompiledProgram> program;
+		try {
+			program = m_programs.acquire(std::move(source));
+		}
+		catch(Error& e) {
+			writeError(request, e);
+			return;
+		}
+
+		{
+			ExecutorPool::Lease lease;
+			Executor& e = *lease;
+			e.setLimits(m_fuel, m_heapLimit);
+			e.m_output.redirect([](const char* const data, const size_t size, void* const userData) {
+				const DaemonRequest& request = *(const DaemonRequest*)userData;
+				request.connection->writeFrame(request.id, "out", data, size);
+			}, (void*)&request);
+
+			// The Inliner adds nodes to the program while it runs.
+			AstNodeOwner::Scope ownerScope(&program->nodes);
+			try {
+				e.run(program->root, nullptr);
+				e.m_output.flush();
+				request.connection->writeFrame(request.id, "done", nullptr, 0);
+			}
+			catch(Error& error) {
+				e.m_output.flush();
+				writeError(request, error);
+			}
+			catch(...) {
+				e.m_output.flush();
+				writeError(request, "Unknown error");
+			}
+		}
+
+		m_programs.release(std::move(program));
+	}
+
+	static void writeError(const DaemonRequest& request, const std::string& message) {
+		request.connection->writeFrame(request.id, "error", message.data(), message.size());
+	}
+
+	static void writeError(const DaemonRequest& request, const Error& error) {
+		char location[64];
+		snprintf(location, sizeof(location), "Error at %d, %d:\n\t", error.location.line, error.location.column);
+		writeError(request, location + error.message);
+	}
+
+	ProgramCache m_programs;
+	const int64_t m_fuel;
+	const size_t m_heapLimit;
+
+	std::mutex m_queueMutex;
+	std::condition_variable m_queueChanged;
+	std::deque<DaemonRequest> m_queue;
+	bool m_isStopping = false;
+
+	std::vector<std::thread> m_workers;
+};
+
+//-----------------------------------------------------------------------------------------------------
+// Batch mode.
+// Runs a function of a script once for each record of a CSV file, on all the cores. The first line of the file names the columns,
+// and the parameters of the function choose the columns that it gets, by name. For example, with the columns id,price,quantity:
+//   total = fn(price, quantity) { return price * quantity; };
+// The output of each record is what the function printed, followed by its result unless it is undefined.
+// Records are written in the order of the file. The top level of the script runs once on each worker to define the function,
+// what it prints is discarded.
+//-----------------------------------------------------------------------------------------------------
+
+// The records of a batch, stored column by column. Strings are immortal buffers owned by the columns (and shared by equal strings),
+// so the workers on any thread could pass them to their scripts without copying them or touching their reference count.
+struct RecordColumns
+{
+	// A single value of a record. The type is undefined (for empty fields), i64, f32 or string.
+	struct Cell
+	{
+		VarType type = varType_undefined;
+		union {
+			int64_t i64;
+			float f32;
+			StringBuffer* string;
+		};
+	};
+
+	RecordColumns() = default;
+	RecordColumns(const RecordColumns&) = delete;
+	RecordColumns& operator=(const RecordColumns&) = delete;
+
+	~RecordColumns() {
+		for(StringBuffer* const string : m_strings) {
+			StringBuffer::destroy(string);
+		}
+	}
+
+	// Parses CSV text. Fields that are quoted are always strings, the others are numbers if they read as such.
+	bool load(const char* const data, const size_t size, std::string& error) {
+		const char* p = data;
+		const char* const end = data + size;
+
+		size_t fieldCount = 0;
+		readRecord(p, end, fieldCount);
+		if(size == 0) {
+			error = "the file is empty";
+			return false;
+		}
+
+		for(size_t t = 0; t < fieldCount; ++t) {
+			names.push_back(m_fields[t].text);
+		}
+		m_columns.resize(fieldCount);
+
+		for(size_t line = 2; p < end; ++line) {
+			readRecord(p, end, fieldCount);
+			if(fieldCount == 1 && m_fields[0].text.empty() && m_fields[0].isQuoted == false) {
+				continue; // An empty line.
+			}
+
+			if(fieldCount != names.size()) {
+				error = "line " + std::to_string(line) + " has " + std::to_string(fieldCount) + " fields, the header has " + std::to_string(names.size());
+				return false;
+			}
+
+			for(size_t t = 0; t < fieldCount; ++t) {
+				m_columns[t].push_back(makeCell(m_fields[t]));
+			}
+		}
+
+		m_recordCount = m_columns.empty() ? 0 : m_columns[0].size();
+		m_fields.clear();
+		m_stringsByChars.clear();
+		return true;
+	}
+
+	size_t recordCount() const {
+		return m_recordCount;
+	}
+
+	// Returns the index of the column with the specified name, or SIZE_MAX if there is no such column.
+	size_t findColumn(const std::string& name) const {
+		const auto itr = std::find(names.begin(), names.end(), name);
+		return itr != names.end() ? (size_t)(itr - names.begin()) : SIZE_MAX;
+	}
+
+	void getValue(const size_t column, const size_t record, Var& value) const {
+		const Cell& cell = m_columns[column][record];
+		switch(cell.type) {
+			case varType_i64: value.makeInt64(cell.i64); break;
+			case varType_f32: value.makeFloat32(cell.f32); break;
+			case varType_string: value.makeString(StringRef(cell.string)); break;
+			default: value = Var(); break;
+		}
+	}
+
+	std::vector<std::string> names;
+
+private :
+
+	struct Field
+	{
+		std::string text;
+		bool isQuoted = false;
+	};
+
+	// Reads the fields of the record at @p into m_fields, and moves @p to the start of the next record.
+	void readRecord(const char*& p, const char* const end, size_t& fieldCount) {
+		fieldCount = 0;
+		for(;;) {
+			if(fieldCount == m_fields.size()) {
+				m_fields.emplace_back();
+			}
+			Field& field = m_fields[fieldCount++];
+			field.text.clear();
+			field.isQuoted = (p < end && *p == '"');
+
+			if(field.isQuoted) {
+				for(++p; p < end; ++p) {
+					if(*p != '"') {
+						field.text.push_back(*p);
+					} else if(p + 1 < end && p[1] == '"') {
+						field.text.push_back('"');
+						++p;
+					} else {
+						++p;
+						break;
+					}
+				}
+			}
+
+			for(; p < end && *p != ',' && *p != '\n'; ++p) {
+				if(*p != '\r') {
+					field.text.push_back(*p);
+				}
+			}
+
+			if(p < end && *p == ',') {
+				++p;
+				continue;
+			}
+			if(p < end) {
+				++p; // The end of the line.
+			}
+			return;
+		}
+	}
+
+	Cell makeCell(const Field& field) {
+		Cell cell;
+		const char* const first = field.text.data();
+		const char* const last = first + field.text.size();
+
+		if(field.isQuoted == false) {
+			if(field.text.empty()) {
+				return cell;
+			}
+
+			int64_t i64 = 0;
+			std::from_chars_result result = std::from_chars(first, last, i64);
+			if(result.ec == std::errc() && result.ptr == last) {
+				cell.type = varType_i64;
+				cell.i64 = i64;
+				return cell;
+			}
+
+			float f32 = 0.f;
+			result = std::from_chars(first, last, f32);
+			if(result.ec == std::errc() && result.ptr == last) {
+				cell.type = varType_f32;
+				cell.f32 = f32;
+				return cell;
+			}
+		}
+
+		StringBuffer*& string = m_stringsByChars[field.text];
+		if(string == nullptr) {
+			string = StringBuffer::allocate(field.text.size());
+			memcpy(string->chars, first, field.text.size());
+			string->isImmortal = true;
+			StringRef(string).hash(); // Computed now, as the workers only read the buffer.
+			m_strings.push_back(string);
+		}
+
+		cell.type = varType_string;
+		cell.string = string;
+		return cell;
+	}
 
-				if(left->m_varType != varType_f32) {
-					ThrowError(n->location, "Expected a number variable");
-				}
+	std::vector<std::vector<Cell>> m_columns;
+	size_t m_recordCount = 0;
+	std::vector<StringBuffer*> m_strings;
 
-				float v = 0.f;
-				if(n->op == tokenType_minus) v = -left->m_value_f32;
-				else if(n->op == tokenType_plus) v = left->m_value_f32;
-				else if(n->op == tokenType_not) v = left->m_value_f32 ? 0.f : 1.f;
-				else ThrowError(n->location, "Unknown unary operation!");
+	// Only used while loading.
+	std::vector<Field> m_fields;
+	std::unordered_map<std::string, StringBuffer*> m_stringsByChars;
+};
 
-				return newVariableFloat(v);
+// Runs the batch on a pool of threads. The records are split in chunks that the workers take in order,
+// and the output of each chunk is written once the chunks before it were written.
+struct BatchRunner
+{
+	static constexpr size_t kRecordsPerChunk = 1024;
+
+	// The script and each record get @fuel, @heapLimit bounds the heap of each worker (see Executor::setLimits).
+	BatchRunner(const RecordColumns& records, std::string source, std::string fnName, const int64_t fuel, const size_t heapLimit)
+		: m_records(records)
+		, m_source(std::move(source))
+		, m_fnName(std::move(fnName))
+		, m_fuel(fuel)
+		, m_heapLimit(heapLimit)
+		, m_chunks((records.recordCount() + kRecordsPerChunk - 1) / kRecordsPerChunk)
+	{}
 
-			}break;
-			case astNodeType_assign:
-			{
-				const AstAssign* const n = (AstAssign*)root;
-				Var* const left = evaluate(n->left, ctx);
-				const Var* const right = evaluate(n->right, ctx);
-				*left = *right;
-				return left;
-			}break;
-			case astNodeType_fnCall:
-			{
-				const AstFnCall* const n = (AstFnCall*)root;
+	// Returns false if the script failed, @error tells why. The output of the records before the failure is still written.
+	bool run(const size_t workerCount, FILE* const out, std::string& error) {
+		std::vector<std::thread> workers;
+		for(size_t t = 0; t < workerCount; ++t) {
+			workers.emplace_back([this]() { runWorker(); });
+		}
 
-				Var* const fn = evaluate(n->theFunction, ctx);
-				if(fn && fn->m_varType == varType_fn)
-				{
-					auto itr = parser->m_fnIdx2fn.find(fn->m_fnIdx);
-					if(itr != parser->m_fnIdx2fn.end())
-					{
-						const AstFnDecl* const fnToCallDecl = (AstFnDecl*)itr->second;
-
-						// Evalute the argument values.
-						std::vector<Var*> argValues;
-						for(int iArg = 0; iArg < n->callArgs.size(); ++iArg) {
-							Var* const val =  evaluate(n->callArgs[iArg], ctx);
-							argValues.push_back(val);
-						}
+		for(Chunk& chunk : m_chunks) {
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_chunkChanged.wait(lock, [&chunk]() { return chunk.state != chunkState_pending; });
+			lock.unlock();
 
-						// Validate that the number of arguments is correct.
-						if(argValues.size() != fnToCallDecl->argsNames.size()) {
-							ThrowError(n->location, "Wrong number of arguments specified to a function call");
-							return nullptr;
-						}
+			fwrite(chunk.output.data(), 1, chunk.output.size(), out);
+			std::string().swap(chunk.output);
+			if(chunk.state != chunkState_done) {
+				break;
+			}
+		}
+		fflush(out);
 
-						// Set the function arguments variable and call the function.
-						pushScope(fnToCallDecl, nullptr);
+		for(std::thread& worker : workers) {
+			worker.join();
+		}
 
-						for(int iArg = 0; iArg < n->callArgs.size(); ++iArg) {
-							Var* const arg = findVariableInScope(fnToCallDecl->argsNames[iArg], true, false);
-							*arg = *argValues[iArg];
-						}
+		error = m_error;
+		return m_error.empty();
+	}
 
-						EvalCtx fnCtx;
-						evaluate(fnToCallDecl->fnBodyBlock, fnCtx);
-						Var* const result = fnCtx.forcedResult;
+private :
 
-						popScope();
+	enum ChunkState : int
+	{
+		chunkState_pending,
+		chunkState_done,
+		chunkState_failed, // The output has the records before the one that failed.
+		chunkState_skipped, // Taken after a failure, so not run at all.
+	};
 
-						if(result == nullptr) {
-							return new Var(varType_undefined);
-						}
+	struct Chunk
+	{
+		ChunkState state = chunkState_pending;
+		std::string output;
+	};
 
-						return result;
-					}
-				}
-				else if(fn && fn->m_varType == varType_fnNative)
-				{
-					if(fn->m_fnNative != nullptr)
-					{
-						// Evaluate argument values.
-						std::vector<Var*> arguments;
-						arguments.reserve(n->callArgs.size());
-						for(AstNode* argExpression : n->callArgs){
-							arguments.push_back( evaluate(argExpression, ctx) );
-						}
+	void runWorker() {
+		std::unique_ptr<CompiledProgram> program;
+		const AstFnDecl* fnDecl = nullptr;
+		std::vector<size_t> argColumns; // The column of each argument of the function.
 
-						// Perform the function call itself.
-						Var* result = nullptr;
-						if(fn->m_fnNative(arguments.size(), arguments.data(), this, &result)) {
-							return result;
-						} else {
-							ThrowError(n->location, "Failed on native function call");
-							return nullptr;
-						}
-					}
-				}
-				
-				ThrowError(n->location, "Uknown function call");
-				return nullptr;
-			}break;
-			case astNodeType_arrayIndexing:
-			{
-				const AstArrayIndexing* const n = (AstArrayIndexing*)root;
-				Var* const array = evaluate(n->theArray, ctx);
-				if(array && array->m_varType == varType_array)
-				{
-					Var* const varIndex = evaluate(n->index, ctx);
+		try {
+			program = compileProgram(m_source, fnv1aHash(m_source.data(), m_source.size()));
+		}
+		catch(Error& e) {
+			fail(e, SIZE_MAX);
+		}
 
-					if(varIndex && varIndex->m_varType == varType_f32) {
-						const int idx = (int)varIndex->m_value_f32;
-						if(idx < 0 || idx >= (*array->m_arrayValues).size()) {
-							ThrowError(n->location, "Out of bounds array indexing");
-							return nullptr;
-						}
-						return &(*array->m_arrayValues)[idx];
-					} else {
-						ThrowError(n->location, "Array index must be a number");
-						return nullptr;
-					}
+		// Declared after the program, so the Executor is reset before the program is freed.
+		AstNodeOwner::Scope ownerScope(program ? &program->nodes : nullptr);
+		ExecutorPool::Lease lease;
+		Executor& e = *lease;
+		e.setLimits(m_fuel, m_heapLimit);
+		std::vector<Var*> args;
+		size_t record = SIZE_MAX;
+
+		try {
+			if(program) {
+				e.m_output.redirect([](const char*, size_t, void*) {}, nullptr);
+				e.run(program->root, nullptr);
+
+				const Var* const fn = e.findVariableInScope(m_fnName, Symbols::intern(m_fnName), false, false);
+				if(fn == nullptr || fn->m_varType != varType_fn) {
+					ThrowError(Location(), m_fnName + " isn't a function of the script");
 				}
+				fnDecl = fn->m_fnDecl;
 
-				ThrowError(n->location, "Only arrays can be indexed");
-				return nullptr;
-			}break;
-			case astNodeType_statementList:
-			{
-				const AstStatementList* const n = (AstStatementList*)root;
-
-				if(n->needsOwnScope) {
-					pushScope(n, nullptr);
+				for(const std::string& argName : fnDecl->argsNames) {
+					const size_t column = m_records.findColumn(argName);
+					if(column == SIZE_MAX) {
+						ThrowError(fnDecl->location, "The input has no column named " + argName);
+					}
+					argColumns.push_back(column);
+					args.push_back(e.newVariableRaw(nullptr, varType_undefined)); // Kept as temporaries for the whole batch.
 				}
+			}
 
-				Var* result = nullptr;
-				for(AstNode* node : n->m_statements) {
-					result = evaluate(node, ctx);
+			const size_t tempRootsWatermark = e.m_tempRoots.size();
+			Var value;
+			for(;;) {
+				const size_t chunkIdx = m_nextChunk++;
+				if(chunkIdx >= m_chunks.size()) {
+					break;
 				}
 
-				if(n->needsOwnScope) {
-					popScope();
+				Chunk& chunk = m_chunks[chunkIdx];
+				if(m_isFailed) {
+					finishChunk(chunk, chunkState_skipped);
+					break;
 				}
 
-				return result;
-			}break;
-			case astNodeType_if:
-			{
-				const AstIf* const n = (AstIf*)root;
-				const Var* const expr = evaluate(n->expression, ctx);
+				e.m_output.redirect([](const char* const data, const size_t size, void* const userData) {
+					((std::string*)userData)->append(data, size);
+				}, &chunk.output);
 
-				if(expr->m_value_f32 != 0.f) {
-					pushScope(n, "true");
-					Var* const expr = evaluate(n->trueBranchStatement, ctx);
-					popScope();
-					return expr;
-				}
-				else if(n->falseBranchStatement) {
-					pushScope(n, "false");
-					Var* const expr = evaluate(n->falseBranchStatement, ctx);
-					popScope();
-					return expr;
-				}
+				const size_t recordEnd = std::min((chunkIdx + 1) * kRecordsPerChunk, m_records.recordCount());
+				for(record = chunkIdx * kRecordsPerChunk; record < recordEnd; ++record) {
+					for(size_t iArg = 0; iArg < args.size(); ++iArg) {
+						m_records.getValue(argColumns[iArg], record, value);
+						e.assignVar(args[iArg], value);
+					}
 
-				return nullptr;
-			}break;
-			case astNodeType_while:
-			{
-				const AstWhile* const n = (AstWhile*)root;
+					e.setFuel(m_fuel);
 
-				pushScope(n, nullptr);
-				const Var* expr = evaluate(n->expression, ctx);
-				while(expr->m_value_f32 != 0.f) {
-					evaluate(n->trueBranchStatement, ctx);
-					expr = evaluate(n->expression, ctx);
-				}
-				popScope();
-	
-				return nullptr;
-			}break;
-			case astNodeType_for:
-			{
-				const AstFor* const n = (AstFor*)root;
-				pushScope(n, nullptr);
-				evaluate(n->initExpression, ctx);
-				const Var* expr = evaluate(n->expression, ctx);
-				while(expr->m_value_f32 != 0.f) {
-					evaluate(n->trueBranchStatement, ctx);
-					evaluate(n->postIterationExpression, ctx);
-					expr = evaluate(n->expression, ctx);
+					const Var* const result = e.callScriptFunction(fnDecl, (int)args.size(), args.data());
+					if(result->m_varType != varType_undefined) {
+						printVariable(e.m_output, result);
+					}
+					e.releaseTempRoots(tempRootsWatermark);
 				}
-				popScope();
 
-				return nullptr;
-			}break;
-			case astNodeType_return:
-			{
-				const AstReturn* const n = (AstReturn*)root;
-				if (n->expression!=nullptr) {
-					ctx.forcedResult = evaluate(n->expression, ctx);
-				} else {
-					ctx.forcedResult = nullptr;
-				}
-				return ctx.forcedResult;
-			}break;
-			case astNodeType_print:
-			{
-				const AstPrint* const n = (AstPrint*)root;
-				const Var* const expr = evaluate(n->expression, ctx);
+				e.m_output.flush();
+				finishChunk(chunk, chunkState_done);
+			}
+		}
+		catch(Error& error) {
+			e.m_output.flush();
+			fail(error, record);
+			if(record != SIZE_MAX) {
+				finishChunk(m_chunks[record / kRecordsPerChunk], chunkState_failed);
+			}
+		}
 
-				printVariable(expr);
+		// Take one more chunk, so the writer doesn't wait for chunks that nobody is going to run.
+		if(m_isFailed) {
+			const size_t chunkIdx = m_nextChunk++;
+			if(chunkIdx < m_chunks.size()) {
+				finishChunk(m_chunks[chunkIdx], chunkState_skipped);
+			}
+		}
+	}
 
-				return nullptr;
-			}break;
+	void finishChunk(Chunk& chunk, const ChunkState state) {
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			chunk.state = state;
 		}
+		m_chunkChanged.notify_all();
+	}
 
-		ThrowError(root->location, "Uknown AST operation");
-		return nullptr;
+	// Keeps the failure of the earliest record (or of the setup of a worker, where @record is SIZE_MAX).
+	// The workers stop taking chunks after a failure.
+	void fail(const Error& error, const size_t record) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if(m_error.empty() || record < m_errorRecord) {
+			m_errorRecord = record;
+			char location[96];
+			if(record != SIZE_MAX) {
+				snprintf(location, sizeof(location), "Error in record %zu at %d, %d:\n\t", record + 1, error.location.line, error.location.column);
+			} else {
+				snprintf(location, sizeof(location), "Error at %d, %d:\n\t", error.location.line, error.location.column);
+			}
+			m_error = location + error.message;
+		}
+		m_isFailed = true;
 	}
 
-private :
+	const RecordColumns& m_records;
+	const std::string m_source;
+	const std::string m_fnName;
+	const int64_t m_fuel;
+	const size_t m_heapLimit;
 
-	void addStnadardLibFunctions() {
+	std::vector<Chunk> m_chunks;
+	std::atomic<size_t> m_nextChunk{0};
+	std::atomic<bool> m_isFailed{false};
 
-		NativeFnPtr const array_size = [](int argc, Var* argv[], Executor* exec, Var** ppResultVariable) -> int {
-			if(argc != 1 || argv[0] == nullptr|| argv[0]->m_varType != varType_array) {
-				return 0;
-			}
+	std::mutex m_mutex;
+	std::condition_variable m_chunkChanged;
+	std::string m_error;
+	size_t m_errorRecord = SIZE_MAX;
+};
 
-			float fSize = 0.f;
-			if(argv[0]->m_arrayValues) {
-				fSize = argv[0]->m_arrayValues->size();
-			}else{
-				ThrowError(Location(), "Internal Error: Uninitialized array");
-			}
+//-----------------------------------------------------------------------------------------------------
+// Pipeline mode.
+// Runs several functions of a script at the same time, each on its own thread, like the stages of a pipeline
+// that pass values to each other through channels (see Channel). Every stage runs the script first, with its output discarded,
+// so a channel opened by the script is the same one in every stage.
+//-----------------------------------------------------------------------------------------------------
 
-			*ppResultVariable = exec->newVariableFloat(fSize);
-			return 1;
-		};
+struct PipelineRunner
+{
+	// The script and then the function of each stage get @fuel, @heapLimit bounds the heap of each stage (see Executor::setLimits).
+	PipelineRunner(std::string source, std::vector<std::string> stageNames, const int64_t fuel, const size_t heapLimit)
+		: m_source(std::move(source))
+		, m_stageNames(std::move(stageNames))
+		, m_fuel(fuel)
+		, m_heapLimit(heapLimit)
+	{}
 
-		newVariableNativeFunction("array_size", array_size);
-	
-		NativeFnPtr const array_pop = [](int argc, Var* argv[], Executor* exec, Var** ppResultVariable) -> int {
-			if(argv[0] == nullptr|| argv[0]->m_varType != varType_array)
-				return 0;
-			
-			if(argc == 1)
-			{
+	// Returns false if a stage failed, @error tells why. The stages print to stdout as they run.
+	bool run(std::string& error) {
+		std::vector<std::thread> stages;
+		for(const std::string& stageName : m_stageNames) {
+			stages.emplace_back([this, &stageName]() { runStage(stageName); });
+		}
 
-				if(argv[0]->m_arrayValues) {
-					if(argv[0]->m_arrayValues->empty() == false) {
-						argv[0]->m_arrayValues->pop_back();
-					}
-				}else{
-					ThrowError(Location(), "Internal Error: Uninitialized array");
-				}
-			}
-			if(argc == 2)
-			{
-				if(argv[0]->m_arrayValues) {
-					if(argv[0]->m_arrayValues->empty() == false) {
-						argv[0]->m_arrayValues->erase(argv[0]->m_arrayValues->begin() + (int)argv[1]->m_value_f32);
-					}
-				}else{
-					ThrowError(Location(), "Internal Error: Uninitialized array");
-				}
-			}
+		for(std::thread& stage : stages) {
+			stage.join();
+		}
+		fflush(stdout);
 
-			return 1;
-		};
-	
-		newVariableNativeFunction("array_pop", array_pop);
+		error = m_error;
+		return m_error.empty();
+	}
 
-		NativeFnPtr const array_push = [](int argc, Var* argv[], Executor* exec, Var** ppResultVariable) -> int {
-			if(argc != 2 || argv[0] == nullptr|| argv[0]->m_varType != varType_array) {
-				return 0;
-			}
+private :
 
-			if(argv[0]->m_arrayValues) {
-				argv[0]->m_arrayValues->push_back(*argv[1]);
-			}else{
-				ThrowError(Location(), "Internal Error: Uninitialized array");
-			}
+	void runStage(const std::string& stageName) {
+		std::unique_ptr<CompiledProgram> program;
+		try {
+			program = compileProgram(m_source, fnv1aHash(m_source.data(), m_source.size()));
+		}
+		catch(Error& e) {
+			fail(e, stageName);
+			return;
+		}
 
-			return 1;
-		};
+		AstNodeOwner::Scope ownerScope(&program->nodes);
+		ExecutorPool::Lease lease;
+		Executor& e = *lease;
+		e.setLimits(m_fuel, m_heapLimit);
+		e.m_channels = &m_channels;
 
-		newVariableNativeFunction("array_push", array_push);
+		try {
+			e.m_output.redirect([](const char*, size_t, void*) {}, nullptr);
+			e.run(program->root, nullptr);
+
+			e.m_output.redirect(nullptr, nullptr);
+			e.setFuel(m_fuel);
+			e.callGlobal(stageName);
+			e.m_output.flush();
+		}
+		catch(Error& error) {
+			e.m_output.flush();
+			fail(error, stageName);
+		}
 	}
-	
-public :
 
-	// TODO: Currently "Parser* parser" used only for m_fnIdx2fn, with a tiny bit of work this dependancy could be removed.
-	// This currently prevents us form injecting more code in our enviornment.
-	Parser* parser = nullptr;
-	std::unordered_map<std::string, Var*> m_variablesLut;
-	std::vector<Var*> m_allocatedVariables;
-	std::vector<std::string> m_scopeStack;
-}; 
+	// Keeps the first failure, and closes every channel so the other stages don't wait forever for the stage that failed.
+	void fail(const Error& error, const std::string& stageName) {
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if(m_error.empty()) {
+				char location[64];
+				snprintf(location, sizeof(location), " at %d, %d:\n\t", error.location.line, error.location.column);
+				m_error = "Error in stage " + stageName + location + error.message;
+			}
+		}
+		m_channels.closeAll();
+	}
+
+	const std::string m_source;
+	const std::vector<std::string> m_stageNames;
+	const int64_t m_fuel;
+	const size_t m_heapLimit;
+
+	ChannelGroup m_channels{true}; // Shared by every stage.
+
+	std::mutex m_mutex;
+	std::string m_error;
+};
 
 ///
 ///
 ///
+// Usage: <script> [--emit-cpp <file>] [--aot <module>] [--fuel <amount>] [--heap-limit <bytes>]
+//                 [--save-snapshot <file>] [--restore-snapshot <file>] [--entry <function>]
+//    or: <script> --batch <csv file> --entry <function> [--workers <count>] [--fuel <amount>] [--heap-limit <bytes>]
+//    or: <script> --pipeline <function>,<function>... [--fuel <amount>] [--heap-limit <bytes>]
+//    or: --serve [--socket <path>] [--workers <count>] [--fuel <amount>] [--heap-limit <bytes>]
+//   --emit-cpp writes the C++ code of the script for building a module ahead of time (see AotEmitter), without running the script.
+//   --aot runs the script with the specified module, if the module can't be used the script is interpreted.
+//   --fuel aborts the script after that many loop iterations and function calls (see Executor::setFuel).
+//   --heap-limit fails the script if it uses more than that many bytes (see Heap::hardLimitBytes), and reports the peak usage.
+//   --save-snapshot saves the global variables once the script is done (see HeapSnapshot).
+//   --restore-snapshot restores the global variables instead of running the script, if the snapshot can't be used the script is run.
+//   --entry calls that global function after the script was run or restored, or for each record with --batch.
+//   --batch runs the --entry function for each record of the file, on all the cores (see BatchRunner).
+//   --pipeline runs each of the functions on its own thread, they pass values to each other through channels (see PipelineRunner).
+//   --serve runs the scripts requested on stdin, or on the Unix domain socket created at the --socket path (see Daemon).
+//   --workers is the number of threads that run scripts in batch and daemon modes, the number of hardware threads by default.
 int main(int argc, const char* argv[])
 {
 	if(argc <= 1) {
 		return 0;
 	}
 
+	const char* emitCppPath = nullptr;
+	const char* aotModulePath = nullptr;
+	int64_t fuel = INT64_MAX;
+	size_t heapLimit = SIZE_MAX;
+	const char* saveSnapshotPath = nullptr;
+	const char* restoreSnapshotPath = nullptr;
+	const char* entryName = nullptr;
+	const char* socketPath = nullptr;
+	const char* batchPath = nullptr;
+	const char* pipelineStages = nullptr;
+	size_t workerCount = std::max(1u, std::thread::hardware_concurrency());
+	for(int iArg = 2; iArg + 1 < argc; iArg += 2) {
+		if(strcmp(argv[iArg], "--emit-cpp") == 0) emitCppPath = argv[iArg + 1];
+		else if(strcmp(argv[iArg], "--aot") == 0) aotModulePath = argv[iArg + 1];
+		else if(strcmp(argv[iArg], "--fuel") == 0) fuel = strtoll(argv[iArg + 1], nullptr, 10);
+		else if(strcmp(argv[iArg], "--heap-limit") == 0) heapLimit = (size_t)strtoull(argv[iArg + 1], nullptr, 10);
+		else if(strcmp(argv[iArg], "--save-snapshot") == 0) saveSnapshotPath = argv[iArg + 1];
+		else if(strcmp(argv[iArg], "--restore-snapshot") == 0) restoreSnapshotPath = argv[iArg + 1];
+		else if(strcmp(argv[iArg], "--entry") == 0) entryName = argv[iArg + 1];
+		else if(strcmp(argv[iArg], "--socket") == 0) socketPath = argv[iArg + 1];
+		else if(strcmp(argv[iArg], "--batch") == 0) batchPath = argv[iArg + 1];
+		else if(strcmp(argv[iArg], "--pipeline") == 0) pipelineStages = argv[iArg + 1];
+		else if(strcmp(argv[iArg], "--workers") == 0) workerCount = std::max<size_t>(1, (size_t)strtoull(argv[iArg + 1], nullptr, 10));
+	}
+
+	if(strcmp(argv[1], "--serve") == 0) {
+		Daemon daemon(workerCount, fuel, heapLimit);
+		if(socketPath) {
+			std::string error;
+			if(!daemon.serveSocket(socketPath, error)) {
+				fprintf(stderr, "Failed to serve on %s (%s)\n", socketPath, error.c_str());
+				return 1;
+			}
+		} else {
+			daemon.serveStdin();
+		}
+		return 0;
+	}
+
 	// Read the contents of the specified file.
 	std::vector<char> fileContents;
 	{
@@ -1682,6 +8108,50 @@ int main(int argc, const char* argv[])
 		}
 	}
 
+	if(batchPath) {
+		if(entryName == nullptr) {
+			fprintf(stderr, "--batch needs the function to run for each record (--entry)\n");
+			return 1;
+		}
+
+		std::string error;
+		MappedFile input;
+		RecordColumns records;
+		if(!input.open(batchPath) || !records.load(input.data(), input.size(), error)) {
+			fprintf(stderr, "Failed to load %s (%s)\n", batchPath, error.empty() ? "could not read the file" : error.c_str());
+			return 1;
+		}
+		input.close();
+
+		const std::string source(fileContents.data(), fileContents.empty() ? 0 : fileContents.size() - 1);
+		BatchRunner runner(records, source, entryName, fuel, heapLimit);
+		if(!runner.run(workerCount, stdout, error)) {
+			fprintf(stderr, "%s\n", error.c_str());
+			return 1;
+		}
+		return 0;
+	}
+
+	if(pipelineStages) {
+		std::vector<std::string> stageNames;
+		for(const char* stageName = pipelineStages; *stageName != '\0'; ) {
+			const char* const stageNameEnd = stageName + strcspn(stageName, ",");
+			if(stageNameEnd != stageName) {
+				stageNames.emplace_back(stageName, stageNameEnd);
+			}
+			stageName = (*stageNameEnd == ',') ? stageNameEnd + 1 : stageNameEnd;
+		}
+
+		std::string error;
+		const std::string source(fileContents.data(), fileContents.empty() ? 0 : fileContents.size() - 1);
+		PipelineRunner runner(source, std::move(stageNames), fuel, heapLimit);
+		if(!runner.run(error)) {
+			fprintf(stderr, "%s\n", error.c_str());
+			return 1;
+		}
+		return 0;
+	}
+
 	try 
 	{
 		// Generate the token list for the parser.
@@ -1694,11 +8164,75 @@ int main(int argc, const char* argv[])
 		p.m_token = tokens.data();
 		AstNode* nodeToExecute = p.parse();
 
+		// Specialize the operations whose types could be proven ahead of time.
+		TypeInference typeInference;
+		typeInference.run(nodeToExecute);
+
+		const uint64_t sourceHash = fnv1aHash(fileContents.data(), fileContents.size());
+
+		if(emitCppPath) {
+			AotEmitter emitter;
+			const std::string code = emitter.emit(nodeToExecute, sourceHash, __FILE__);
+			FILE* const f = fopen(emitCppPath, "wb");
+			if(f == nullptr) {
+				printf("Failed to write %s\n", emitCppPath);
+				return 1;
+			}
+			fwrite(code.data(), 1, code.size(), f);
+			fclose(f);
+			return 0;
+		}
+
+		AotModule* aotModule = nullptr;
+		if(aotModulePath) {
+			std::string error;
+			aotModule = new AotModule();
+			if(!aotModule->load(aotModulePath, nodeToExecute, sourceHash, error)) {
+				fprintf(stderr, "Ignoring %s (%s), interpreting the script instead.\n", aotModulePath, error.c_str());
+				delete aotModule;
+				aotModule = nullptr;
+			}
+		}
+
 		// Evaluate the produced AST.
 		Executor e;
-		e.parser = &p;
-		Executor::EvalCtx ctx;
-		e.evaluate(nodeToExecute, ctx);
+		e.setLimits(fuel, heapLimit);
+
+		bool isRestored = false;
+		if(restoreSnapshotPath) {
+			std::string error;
+			HeapSnapshot snapshot;
+			isRestored = snapshot.restore(e, p, sourceHash, restoreSnapshotPath, error);
+			if(!isRestored) {
+				fprintf(stderr, "Ignoring %s (%s), running the script instead.\n", restoreSnapshotPath, error.c_str());
+			}
+		}
+
+		try {
+			if(!isRestored) {
+				e.run(nodeToExecute, aotModule ? aotModule->program() : nullptr);
+			}
+
+			if(saveSnapshotPath) {
+				std::string error;
+				HeapSnapshot snapshot;
+				if(!snapshot.save(e, sourceHash, saveSnapshotPath, error)) {
+					fprintf(stderr, "Failed to save %s (%s)\n", saveSnapshotPath, error.c_str());
+				}
+			}
+
+			if(entryName) {
+				e.callGlobal(entryName);
+			}
+		}
+		catch(...) {
+			e.m_output.flush();
+			if(heapLimit != SIZE_MAX) fprintf(stderr, "Peak heap usage: %zu bytes\n", e.m_heap.peakBytes());
+			throw;
+		}
+
+		e.m_output.flush();
+		if(heapLimit != SIZE_MAX) fprintf(stderr, "Peak heap usage: %zu bytes\n", e.m_heap.peakBytes());
 
 		const int done = 0;
 	}
@@ -1711,7 +8245,11 @@ int main(int argc, const char* argv[])
 		printf("Unknown error");
 	}
 
+#if defined(_WIN32)
 	system("pause");
+#endif
 
 	return 0;
-}
\ No newline at end of file
+}
+
+#endif // BLOG_AOT_MODULE